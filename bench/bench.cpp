@@ -0,0 +1,239 @@
+#include "history.h"
+#include "specialchars.h"
+#include "theme.h"
+#include "workloads.h"
+
+#include <QElapsedTimer>
+#include <QFont>
+#include <QFontMetrics>
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+/** Measures how fast shell output makes it through the parser and the
+ *  history, and optionally onto the screen.
+ *
+ *  Each workload is fed to a SpecialChars/History pair in READ_SIZE chunks,
+ *  the way TerminalWidget receives it from the shell. The "parse" stage stops
+ *  there; the "render" stage additionally draws the viewport into an
+ *  offscreen QImage every READS_PER_FRAME reads, the same way
+ *  TerminalWidget::paintEvent() does.
+ *
+ *  Usage: bench [megabytes per workload]
+ *
+ *  On a machine without a display, run with QT_QPA_PLATFORM=offscreen.
+ */
+
+#define BENCH_FONT_FAMILY   "Andale Mono"   // See TERMINAL_FONT_FAMILY
+#define BENCH_FONT_HEIGHT   12
+
+static const int ROWS = 50;
+static const int COLS = 160;
+static const int READ_SIZE = 4096;
+static const int READS_PER_FRAME = 16;
+static const int RUNS = 3;
+
+
+// Count every heap allocation. Qt's containers allocate with malloc() rather
+// than operator new, so on glibc malloc itself is replaced with a counting
+// wrapper. Elsewhere only operator new is counted.
+
+static qint64 g_allocs = 0;
+
+#if defined(__GLIBC__)
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size) __THROW
+{
+    ++g_allocs;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) __THROW
+{
+    ++g_allocs;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+    ++g_allocs;
+    return __libc_realloc(ptr, size);
+}
+
+#define ALLOCS_COUNTED "all heap allocations"
+
+#else
+
+void *operator new(size_t size)
+{
+    ++g_allocs;
+
+    void *ret = malloc(size);
+    if (!ret)
+        throw std::bad_alloc();
+
+    return ret;
+}
+
+void operator delete(void *ptr) throw()
+{
+    free(ptr);
+}
+
+#define ALLOCS_COUNTED "operator new only"
+
+#endif
+
+
+/** Draws the bottom of the history into the image, like paintEvent() */
+static void paint(const History &history, const Theme &theme, QImage *image)
+{
+    QPainter p(image);
+
+    QFont font(BENCH_FONT_FAMILY, BENCH_FONT_HEIGHT);
+    font.setHintingPreference(QFont::PreferFullHinting);
+    p.setFont(font);
+
+    p.fillRect(image->rect(), theme.color(0));
+
+    QFontMetrics fm(font);
+    int lineHeight = fm.lineSpacing(),
+        charWidth = fm.averageCharWidth(),
+        bottom = history.numLines() * lineHeight,
+        top = qMax(bottom - ROWS * lineHeight, 0);
+
+    RenderData rd = history.renderData(top, bottom, lineHeight);
+
+    int y = lineHeight;
+    rd.begin();
+
+    while (rd.nextLine())
+    {
+        RenderData::Section section;
+        int x = 0;
+
+        while (rd.next(&section))
+        {
+            const Style &style = section.style;
+
+            if (style.background != Style::DEFAULT_BACKGROUND ||
+                (style.attributes & Style::INVERSE))
+            {
+                p.fillRect(x, y, section.data.size() * charWidth, lineHeight,
+                           theme.background(style));
+            }
+
+            QFont styled(font);
+            styled.setBold((style.attributes & Style::BOLD) != 0);
+            styled.setItalic((style.attributes & Style::ITALIC) != 0);
+            styled.setUnderline((style.attributes & Style::UNDERLINE) != 0);
+            styled.setStrikeOut((style.attributes & Style::STRIKEOUT) != 0);
+
+            p.setFont(styled);
+            p.setPen(theme.foreground(style));
+            p.drawText(x, y, section.data);
+            x += section.data.size() * charWidth;
+        }
+
+        y += lineHeight;
+    }
+
+    rd.end();
+}
+
+struct Result
+{
+    qint64 nsecs;
+    qint64 allocs;
+};
+
+static Result run(const Workload &w, bool render, const Theme &theme,
+                  QImage *image)
+{
+    History history;
+    SpecialChars chars(&history);
+    history.onViewportResized(ROWS, COLS);
+
+    const char *data = w.data.constData();
+    int size = w.data.size();
+
+    Result ret;
+    qint64 allocs = g_allocs;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int pos = 0, reads = 0; pos < size; pos += READ_SIZE, ++reads)
+    {
+        history.beginWrite();
+        chars.parse(data + pos, qMin(READ_SIZE, size - pos));
+        history.endWrite();
+
+        if (render && reads % READS_PER_FRAME == 0)
+            paint(history, theme, image);
+    }
+
+    ret.nsecs = timer.nsecsElapsed();
+    ret.allocs = g_allocs - allocs;
+
+    return ret;
+}
+
+static void report(const Workload &w, const char *stage, const Result &r)
+{
+    double mb = w.data.size() / (1024.0 * 1024.0);
+
+    printf("%-10s %-8s %10.1f %10.2f %12.1f\n",
+           w.name, stage,
+           mb / (r.nsecs / 1e9),
+           (double)r.nsecs / w.data.size(),
+           r.allocs / mb);
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    int megabytes = (argc > 1) ? atoi(argv[1]) : 16;
+    if (megabytes <= 0)
+        megabytes = 16;
+
+    QList<Workload> workloads = makeWorkloads(megabytes * 1024 * 1024);
+
+    Theme theme;
+    QImage image(COLS * 8, ROWS * 16, QImage::Format_RGB32);
+
+    printf("%d MB per workload, %d byte reads, %s counted\n\n",
+           megabytes, READ_SIZE, ALLOCS_COUNTED);
+    printf("%-10s %-8s %10s %10s %12s\n",
+           "workload", "stage", "MB/s", "ns/byte", "allocs/MB");
+
+    foreach (const Workload &w, workloads)
+    {
+        for (int stage = 0; stage < 2; ++stage)
+        {
+            bool render = (stage == 1);
+
+            // Report the fastest of a few runs, to filter out noise
+            Result best = run(w, render, theme, &image);
+            for (int i = 1; i < RUNS; ++i)
+            {
+                Result r = run(w, render, theme, &image);
+                if (r.nsecs < best.nsecs)
+                    best = r;
+            }
+
+            report(w, render ? "render" : "parse", best);
+        }
+    }
+
+    return 0;
+}
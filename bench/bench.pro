@@ -0,0 +1,32 @@
+
+TARGET    = bench
+TEMPLATE  = app
+
+QT       += core gui
+CONFIG   += console
+CONFIG   -= app_bundle
+
+INCLUDEPATH += ..
+
+HEADERS  += ../cell.h \
+            ../escapehandler.h \
+            ../history.h \
+            ../lineindex.h \
+            ../renderdata.h \
+            ../screen.h \
+            ../scrollback.h \
+            ../specialchars.h \
+            ../styletable.h \
+            ../theme.h \
+            workloads.h
+
+SOURCES  += bench.cpp \
+            ../history.cpp \
+            ../lineindex.cpp \
+            ../renderdata.cpp \
+            ../screen.cpp \
+            ../scrollback.cpp \
+            ../specialchars.cpp \
+            ../styletable.cpp \
+            ../theme.cpp \
+            workloads.cpp
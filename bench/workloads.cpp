@@ -0,0 +1,219 @@
+#include "workloads.h"
+
+#include <cstdio>
+
+/** A small deterministic random number generator, so every run benchmarks
+ *  exactly the same bytes
+ */
+class Random
+{
+public:
+    Random(uint seed) : m_state(seed) { }
+
+    /** Returns a number in [0, n) */
+    int next(int n)
+    {
+        m_state = m_state * 1103515245 + 12345;
+        return (int)((m_state >> 8) % (uint)n);
+    }
+
+private:
+    uint m_state;
+};
+
+static const char *WORDS[] =
+{
+    "request", "worker", "cache", "miss", "hit", "connection", "closed",
+    "timeout", "retrying", "bytes", "user", "session", "queue", "flushed",
+    "src/history.cpp", "build", "warning:", "error:", "main.o", "done"
+};
+
+static const int NUM_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+
+static void appendf(QByteArray *out, const char *format, int a, int b = 0,
+                    int c = 0, int d = 0)
+{
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), format, a, b, c, d);
+    out->append(buf, n);
+}
+
+static QByteArray makeAscii(int size)
+{
+    Random r(1);
+    QByteArray out;
+    out.reserve(size + 256);
+
+    while (out.size() < size)
+    {
+        appendf(&out, "2015-03-%02d %02d:%02d:%02d ",
+                1 + r.next(28), r.next(24), r.next(60), r.next(60));
+        out.append(r.next(10) ? "INFO  " : "WARN  ");
+
+        int words = 4 + r.next(12);
+        for (int i = 0; i < words; ++i)
+        {
+            out.append(WORDS[r.next(NUM_WORDS)]);
+            out.append(' ');
+        }
+
+        appendf(&out, "id=%d\r\n", r.next(100000));
+    }
+
+    return out;
+}
+
+static QByteArray makeSgr(int size)
+{
+    Random r(2);
+    QByteArray out;
+    out.reserve(size + 256);
+
+    while (out.size() < size)
+    {
+        int words = 6 + r.next(10);
+        for (int i = 0; i < words; ++i)
+        {
+            switch (r.next(4))
+            {
+                case 0:
+                    appendf(&out, "\x1b[%d;%dm", r.next(2), 30 + r.next(8));
+                    break;
+
+                case 1:
+                    appendf(&out, "\x1b[1;4;38;5;%dm", r.next(256));
+                    break;
+
+                case 2:
+                    appendf(&out, "\x1b[38;2;%d;%d;%dm",
+                            r.next(256), r.next(256), r.next(256));
+                    break;
+
+                default:
+                    appendf(&out, "\x1b[7;%dm", 90 + r.next(8));
+                    break;
+            }
+
+            out.append(WORDS[r.next(NUM_WORDS)]);
+            out.append("\x1b[0m ");
+        }
+
+        out.append("\r\n");
+    }
+
+    return out;
+}
+
+static QByteArray makeTui(int size)
+{
+    Random r(3);
+    QByteArray out;
+    out.reserve(size + 4096);
+
+    // Switch to the alternate screen, like any full-screen program
+    out.append("\x1b[?1049h\x1b[H\x1b[2J");
+
+    while (out.size() < size)
+    {
+        // Redraw every row of a 50x160 screen, with a colored header, a few
+        // highlighted rows and a status line at the bottom
+        for (int row = 1; row <= 50; ++row)
+        {
+            appendf(&out, "\x1b[%d;1H", row);
+
+            if (row == 1 || row == 50)
+                out.append("\x1b[30;46m");
+            else if (r.next(8) == 0)
+                out.append("\x1b[1;37;44m");
+
+            int cols = 0;
+            while (cols < 150)
+            {
+                const char *word = WORDS[r.next(NUM_WORDS)];
+                out.append(word);
+                out.append(' ');
+                cols += qstrlen(word) + 1;
+            }
+
+            out.append("\x1b[K\x1b[m");
+        }
+
+        // Scroll part of the screen, like a pager
+        out.append("\x1b[3;48r\x1b[48;1H\n\n\n\x1b[r");
+    }
+
+    out.append("\x1b[?1049l");
+
+    return out;
+}
+
+static QByteArray makeLong(int size)
+{
+    Random r(4);
+    QByteArray out;
+    out.reserve(size + 256);
+
+    while (out.size() < size)
+    {
+        int len = 2000 + r.next(20000);
+        for (int i = 0; i < len; ++i)
+            out.append((char)('!' + r.next(94)));
+
+        out.append("\r\n");
+    }
+
+    return out;
+}
+
+static QByteArray makeProgress(int size)
+{
+    Random r(5);
+    QByteArray out;
+    out.reserve(size + 256);
+
+    while (out.size() < size)
+    {
+        for (int percent = 0; percent <= 100; ++percent)
+        {
+            out.append("\r[");
+
+            for (int i = 0; i < 50; ++i)
+                out.append(i < percent / 2 ? '#' : ' ');
+
+            appendf(&out, "] %3d%% %d KB/s", percent, 100 + r.next(900));
+        }
+
+        out.append("\r\n");
+    }
+
+    return out;
+}
+
+QList<Workload> makeWorkloads(int size)
+{
+    QList<Workload> ret;
+
+    Workload w;
+
+    w.name = "ascii";
+    w.data = makeAscii(size);
+    ret.append(w);
+
+    w.name = "sgr";
+    w.data = makeSgr(size);
+    ret.append(w);
+
+    w.name = "tui";
+    w.data = makeTui(size);
+    ret.append(w);
+
+    w.name = "long";
+    w.data = makeLong(size);
+    ret.append(w);
+
+    w.name = "progress";
+    w.data = makeProgress(size);
+    ret.append(w);
+
+    return ret;
+}
@@ -0,0 +1,31 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <QByteArray>
+#include <QList>
+
+/** A canned stream of shell output to benchmark with */
+struct Workload
+{
+    /** A short name to print in the results */
+    const char *name;
+
+    /** The bytes the "shell" writes */
+    QByteArray data;
+};
+
+/** Generates the standard set of workloads, each roughly the given number of
+ *  bytes long. The output is the same on every run, so results can be
+ *  compared across builds.
+ *
+ *  - ascii:    a plain log file, as written by cat
+ *  - sgr:      ls --color / compiler style output, with a color change every
+ *              word, mixing 16-color, 256-color and 24-bit sequences
+ *  - tui:      full-screen redraws on the alternate screen, like htop:
+ *              cursor addressing, colored rows and clears
+ *  - long:     lines several thousand characters long without a newline
+ *  - progress: a progress bar redrawn in place with CR
+ */
+QList<Workload> makeWorkloads(int size);
+
+#endif // WORKLOADS_H
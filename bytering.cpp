@@ -0,0 +1,83 @@
+#include "bytering.h"
+
+ByteRing::ByteRing(int capacity)
+    : m_data(new char[capacity]),
+      m_mask(capacity - 1),
+      m_head(0),
+      m_tail(0),
+      m_full(0)
+{
+    Q_ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+}
+
+ByteRing::~ByteRing()
+{
+    delete[] m_data;
+}
+
+int ByteRing::capacity() const
+{
+    return m_mask + 1;
+}
+
+char *ByteRing::writeBuffer(int *n)
+{
+    // The positions only ever grow, and wrap around together, so unsigned
+    // subtraction gives the fill level even across the wrap
+    uint head = m_head.load(),
+         tail = m_tail.loadAcquire(),
+         offset = head & m_mask,
+         space = m_mask + 1 - (head - tail);
+
+    *n = qMin(space, m_mask + 1 - offset);
+    return m_data + offset;
+}
+
+void ByteRing::commit(int n)
+{
+    m_head.storeRelease(m_head.load() + n);
+}
+
+bool ByteRing::markFull()
+{
+    m_full.fetchAndStoreOrdered(1);
+
+    // The consumer may have released space between the producer's last
+    // check and the store above, without seeing the flag
+    int n;
+    writeBuffer(&n);
+
+    if (n > 0)
+    {
+        m_full.fetchAndStoreOrdered(0);
+        return false;
+    }
+
+    return true;
+}
+
+const char *ByteRing::readBuffer(int *n)
+{
+    uint tail = m_tail.load(),
+         head = m_head.loadAcquire(),
+         offset = tail & m_mask;
+
+    *n = qMin(head - tail, m_mask + 1 - offset);
+    return m_data + offset;
+}
+
+bool ByteRing::release(int n)
+{
+    m_tail.fetchAndAddOrdered(n);
+    return m_full.fetchAndStoreOrdered(0) != 0;
+}
+
+uint ByteRing::committed() const
+{
+    return m_head.loadAcquire();
+}
+
+uint ByteRing::released() const
+{
+    return m_tail.loadAcquire();
+}
@@ -0,0 +1,83 @@
+#ifndef BYTERING_H
+#define BYTERING_H
+
+#include <QAtomicInteger>
+
+/** A fixed-size ring buffer of bytes, shared by exactly one producer thread
+ *  and one consumer thread without locking.
+ *
+ *  Both sides work on the buffer in place: the producer asks for free space
+ *  with writeBuffer(), fills it (e.g. straight from read()) and publishes it
+ *  with commit(); the consumer asks for pending data with readBuffer(),
+ *  processes it and frees it with release(). Nothing is copied or allocated
+ *  after construction.
+ *
+ *  When the buffer is full, the producer calls markFull() before going to
+ *  sleep, and the consumer's next release() reports that the producer needs
+ *  to be woken up. The handshake is done with ordered atomics on both sides,
+ *  so a wakeup can't be lost between the producer's check and its sleep.
+ */
+class ByteRing
+{
+public:
+    /** The capacity must be a power of two */
+    explicit ByteRing(int capacity);
+    ~ByteRing();
+
+    /** Returns the number of bytes the buffer can hold */
+    int capacity() const;
+
+    /** Producer: returns where the next bytes go, and sets *n to the number
+     *  of bytes that can be written there in one piece (zero if the buffer
+     *  is full)
+     */
+    char *writeBuffer(int *n);
+
+    /** Producer: makes n bytes written to writeBuffer() visible to the
+     *  consumer
+     */
+    void commit(int n);
+
+    /** Producer: records that the producer is about to wait for space.
+     *  Returns false if the consumer freed some in the meantime, in which
+     *  case the producer should carry on instead
+     */
+    bool markFull();
+
+    /** Consumer: returns the oldest unread data, and sets *n to the number of
+     *  bytes that can be read there in one piece (zero if the buffer is
+     *  empty)
+     */
+    const char *readBuffer(int *n);
+
+    /** Consumer: frees the first n bytes returned by readBuffer(). Returns
+     *  true if the producer called markFull() and should be woken up
+     */
+    bool release(int n);
+
+    /** Either side: the total number of bytes committed and released so
+     *  far, modulo 2^32. Useful for marking positions in the stream
+     */
+    uint committed() const;
+    uint released() const;
+
+private:
+    char *m_data;
+    uint m_mask;
+
+    /** The total number of bytes ever committed and released. The
+     *  difference is the number of bytes in the buffer; each is written by
+     *  one side only
+     */
+    QAtomicInteger<uint> m_head;
+    QAtomicInteger<uint> m_tail;
+
+    /** Set by markFull(), cleared by release() */
+    QAtomicInteger<uint> m_full;
+
+    // Not copyable
+    ByteRing(const ByteRing &);
+    ByteRing &operator=(const ByteRing &);
+};
+
+#endif // BYTERING_H
@@ -0,0 +1,27 @@
+#ifndef CELL_H
+#define CELL_H
+
+#include <QtGlobal>
+
+/** A single character cell on the screen.
+ *
+ *  Every cell is exactly four bytes: one UTF-16 code unit plus the id of its
+ *  style in the owning History's StyleTable. Lines of text are stored as
+ *  contiguous arrays of cells, so rendering a line or looking up a single
+ *  cell only ever touches one array.
+ */
+struct Cell
+{
+    Cell() : ch(' '), style(0) { }
+    Cell(ushort ch, ushort style) : ch(ch), style(style) { }
+
+    /** The character in this cell */
+    ushort ch;
+
+    /** The id of this cell's style. See StyleTable */
+    ushort style;
+};
+
+Q_DECLARE_TYPEINFO(Cell, Q_PRIMITIVE_TYPE);
+
+#endif // CELL_H
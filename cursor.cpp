@@ -16,7 +16,9 @@ Cursor::Cursor(TerminalWidget *parent)
     connect(&m_blinkTimer, SIGNAL(timeout()), SLOT(onBlinkTimer()));
     connect(&m_hideTimer, SIGNAL(timeout()), SLOT(onHideTimer()));
 
-    beginOnBlink();
+    // Start the blink cycle. The parent widget isn't fully constructed yet,
+    // so don't ask it to repaint (see beginOnBlink())
+    m_blinkTimer.start(m_blinkOn);
 }
 
 Cursor::~Cursor() { }
@@ -34,13 +36,13 @@ int Cursor::col() const
 void Cursor::show()
 {
     m_hidden = false;
-    m_parent->update();
+    repaint();
 }
 
 void Cursor::hide(int ms)
 {
     m_hidden = true;
-    m_parent->update();
+    repaint();
 
     m_hideTimer.setSingleShot(true);
     m_hideTimer.start(ms);
@@ -78,6 +80,8 @@ void Cursor::setBlinkPause(int val)
 
 void Cursor::moveTo(int row, int col)
 {
+    repaint();
+
     m_row = row;
     m_col = col;
 
@@ -86,6 +90,8 @@ void Cursor::moveTo(int row, int col)
 
 void Cursor::moveBy(int rowDelta, int colDelta)
 {
+    repaint();
+
     m_row += rowDelta;
     m_col += colDelta;
 
@@ -108,16 +114,21 @@ void Cursor::render(QPainter &p)
         x = m_col * w,
         y = m_row * h - m_parent->scrollAmount();
 
+    // The frame on screen carries the cell under the cursor
+    const Frame &frame = m_parent->frame();
+    const Theme &theme = m_parent->theme();
+
+    const Style &style = frame.cursorStyle;
+
     // Draw the cursor itself
-    QBrush fg(m_parent->foregroundColorAt(m_row, m_col));
+    QBrush fg(theme.foreground(style));
     p.fillRect(x, y + fm.descent(), w, fm.ascent() + fm.descent(), fg);
     
     // Draw the inverted character the cursor is over
     p.setFont(font);
-    p.setPen(QColor(m_parent->backgroundColorAt(m_row, m_col)));
+    p.setPen(theme.background(style));
 
-    QChar c = m_parent->history().charAt(m_row, m_col);
-    p.drawText(x, y + fm.lineSpacing(), QString(c));
+    p.drawText(x, y + fm.lineSpacing(), QString(frame.cursorChar));
 }
 
 void Cursor::onBlinkTimer()
@@ -136,7 +147,7 @@ void Cursor::onHideTimer()
 void Cursor::beginOnBlink()
 {
     m_blinkVisible = true;
-    m_parent->update();
+    repaint();
 
     m_blinkTimer.start(m_blinkOn);
 }
@@ -144,7 +155,7 @@ void Cursor::beginOnBlink()
 void Cursor::beginOffBlink()
 {
     m_blinkVisible = false;
-    m_parent->update();
+    repaint();
 
     m_blinkTimer.start(m_blinkOff);
 }
@@ -154,8 +165,21 @@ void Cursor::beginPauseBlink()
     m_blinkTimer.stop();
 
     m_blinkVisible = true;
-    m_parent->update();
+    repaint();
 
     m_blinkTimer.start(m_blinkPause);
 }
 
+void Cursor::repaint()
+{
+    QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
+    QFontMetrics fm(font);
+
+    // Cover both the block drawn by render() and the character on top of it
+    int w = fm.averageCharWidth(),
+        h = fm.lineSpacing(),
+        x = m_col * w,
+        y = m_row * h - m_parent->scrollAmount();
+
+    m_parent->update(x, y, w + 1, h + fm.descent() + 1);
+}
@@ -92,6 +92,9 @@ private:
     void beginOnBlink();
     void beginOffBlink();
     void beginPauseBlink();
+
+    /** Schedules a repaint of the cell the cursor is over */
+    void repaint();
 };
 
 #endif // CURSOR_H
@@ -0,0 +1,116 @@
+#ifndef ESCAPEHANDLER_H
+#define ESCAPEHANDLER_H
+
+#include "specialchars.h"
+#include "styletable.h"
+
+/** Receives the control characters and escape sequences recognized by a
+ *  SpecialChars object that act on the terminal's contents.
+ *
+ *  These are plain virtual calls rather than Qt signals, since colored or
+ *  full-screen output produces a lot of them and each one would otherwise go
+ *  through the meta-object system. UI-level events like the bell or the
+ *  window title are still raised as signals by SpecialChars.
+ */
+class EscapeHandler
+{
+public:
+    virtual ~EscapeHandler() { }
+
+    /** Write n characters of text at the cursor. The text never contains
+     *  control characters
+     */
+    virtual void print(const QChar *text, int n) = 0;
+
+    /** Move the cursor to the start of the next line */
+    virtual void lineFeed() = 0;
+
+    /** Move the cursor to the beginning of its line */
+    virtual void carriageReturn() = 0;
+
+    /** Delete n characters on this line, starting at the cursor */
+    virtual void del(int n) = 0;
+
+    /** Clear some part of the screen. See EraseType for specific behaviors */
+    virtual void erase(SpecialChars::EraseType type) = 0;
+
+    /** Clear the screen */
+    virtual void formFeed() = 0;
+
+    /** Indent the cursor */
+    virtual void horizontalTab() = 0;
+
+    /** Insert n blank characters, starting at the cursor.
+     *  Do not move the cursor.
+     */
+    virtual void insert(int n) = 0;
+
+    /** Move the cursor relative to its current position */
+    virtual void moveCursorBy(int rowDelta, int colDelta) = 0;
+
+    /** Move the cursor to the given position.
+     *  If either row or col is negative, don't change the corresponding
+     *  property of the cursor
+     */
+    virtual void moveCursorTo(int row, int col) = 0;
+
+    /** Set the cursor position to the position stored during the
+     *  corresponding pushCursorPosition() operation. If there is no matching
+     *  operation, do nothing.
+     *
+     *  Ignored unless overridden.
+     */
+    virtual void popCursorPosition() { }
+
+    /** Store the cursor's current position on a stack.
+     *
+     *  Ignored unless overridden.
+     */
+    virtual void pushCursorPosition() { }
+
+    /** Sets the colors and attributes of new text back to the default */
+    virtual void resetStyle() = 0;
+
+    /** Scroll the contents of the scroll region down by the given number of
+     *  lines, adding blank lines at the top. If nlines is negative, scroll
+     *  the contents up by that many lines, adding blank lines at the bottom
+     */
+    virtual void scroll(int nlines) = 0;
+
+    /** Switch to or from the alternate screen (DEC private modes 47, 1047
+     *  and 1049)
+     */
+    virtual void setAlternateScreen(bool enabled) = 0;
+
+    /** Turn the given attributes of new text on or off
+      * @param attributes is a combination of Style::Attribute flags
+      * @param on indicates whether to turn the attributes on or off
+      */
+    virtual void setAttributes(int attributes, bool on) = 0;
+
+    /** Set either the foreground or the background color of new text
+      * @param color is a palette index (0 <= color <= 255) or a 24-bit
+      *              color made by Style::rgb()
+      * @param foreground indicates whether to set the foreground or background
+      *                   color
+      */
+    virtual void setColor(int color, bool foreground) = 0;
+
+    /** Begin or end a synchronized update (DEC private mode 2026). The
+     *  application sets this mode before redrawing and resets it once the
+     *  redraw is complete, so the screen should not be shown in between.
+     *
+     *  Ignored unless overridden.
+     */
+    virtual void setSynchronizedOutput(bool enabled) { Q_UNUSED(enabled); }
+
+    /** Set the scroll region to the rows [top, bottom). If bottom is zero or
+     *  less, the region extends to the bottom of the screen
+     */
+    virtual void setScrollRegion(int top, int bottom) = 0;
+
+    /** Add several newlines */
+    virtual void verticalTab() = 0;
+};
+
+#endif // ESCAPEHANDLER_H
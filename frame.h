@@ -0,0 +1,70 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "renderdata.h"
+#include "screen.h"
+#include "styletable.h"
+
+#include <QChar>
+
+/** An immutable snapshot of a terminal's contents, published by a Session
+ *  for the GUI thread to paint.
+ *
+ *  A frame only holds the rows that can be on screen: normally the last
+ *  screenful of the history, or the rows the view asked for with
+ *  Session::scrollTo() if it was scrolled back since the last output.
+ *
+ *  The GUI may skip frames when the shell writes faster than it paints, so
+ *  events that views react to (evictions, form feeds, output) are recorded as
+ *  running totals. A view compares them against the last frame it handled to
+ *  find out what happened in between.
+ */
+struct Frame
+{
+    Frame()
+        : renderData(QVector<RenderData::Section>()),
+          serial(0), numLines(0), firstRow(0), lastRow(0),
+          cursorRow(0), cursorCol(0), cursorChar(' '),
+          alternate(false), writes(0), evicted(0), formFeeds(0)
+    {
+        damage.all = true;
+    }
+
+    /** The sections of the rows [firstRow, lastRow). Section::line is the
+     *  row number, as for History::renderData()
+     */
+    RenderData renderData;
+
+    /** Increases by one for every frame published by a Session */
+    int serial;
+
+    /** The number of rows in the history, see History::numLines() */
+    int numLines;
+
+    /** The range of rows covered by renderData */
+    int firstRow;
+    int lastRow;
+
+    /** The position of the cursor, and the cell under it */
+    int cursorRow;
+    int cursorCol;
+    QChar cursorChar;
+    Style cursorStyle;
+
+    /** Whether the alternate screen is active */
+    bool alternate;
+
+    /** What changed since the previous frame. Only meaningful if the view
+     *  handled that frame, i.e. if its serial is one less than this one's
+     */
+    Screen::Damage damage;
+
+    /** Running totals: the number of reads from the shell, of rows evicted
+     *  from the top of the history, and of requests to scroll to the bottom
+     */
+    int writes;
+    int evicted;
+    int formFeeds;
+};
+
+#endif // FRAME_H
@@ -2,174 +2,212 @@
 #include "history.h"
 
 History::History() 
-    : m_cursorLine(0),
+    : m_style(0),
+      m_sweepDelay(0),
+      m_cursorLine(0),
       m_cursorCol(0),
       m_numRowsVisible(0),
-      m_numColsVisible(0)
+      m_numColsVisible(0),
+      m_dirtyBegin(0),
+      m_dirtyEnd(0),
+      m_maxLines(DEFAULT_MAX_LINES),
+      m_alternate(false),
+      m_synchronized(false),
+      m_heldUpdated(false),
+      m_heldScrollToBottom(false),
+      m_heldEvicted(0),
+      m_heldAlternate(false)
 { 
-    m_lines.append("");
-    m_vlines.append(vline());
+    m_lines.appendLine();
+    m_index.appendLine(0);
 }
 
 History::~History() { }
 
-void History::connectTo(SpecialChars *chars) const
-{
-    connect(chars, SIGNAL(carriageReturn()), SLOT(carriageReturn()));
-    connect(chars, SIGNAL(del(int)), SLOT(del(int)));
-    connect(chars, SIGNAL(erase(SpecialChars::EraseType)), 
-                     SLOT(erase(SpecialChars::EraseType)));
-    connect(chars, SIGNAL(formFeed()), SLOT(formFeed()));
-    connect(chars, SIGNAL(horizontalTab()), SLOT(horizontalTab()));
-    connect(chars, SIGNAL(insert(int)), SLOT(insert(int)));
-    connect(chars, SIGNAL(moveCursorBy(int, int)), 
-                     SLOT(moveCursorBy(int, int)));
-    connect(chars, SIGNAL(moveCursorTo(int, int)), 
-                     SLOT(moveCursorTo(int, int)));
-    connect(chars, SIGNAL(resetColors()), SLOT(resetColors()));
-    connect(chars, SIGNAL(setColor(SpecialChars::Color, bool, bool)),
-                     SLOT(setColor(SpecialChars::Color, bool, bool)));
-    connect(chars, SIGNAL(setColor256(int, bool)), 
-                     SLOT(setColor256(int, bool)));
-    connect(chars, SIGNAL(verticalTab()), SLOT(verticalTab()));
-}
-
 void History::beginWrite() { }
 
 void History::write(QChar c)
 {
-    Q_ASSERT(m_cursorLine < m_vlines.size());
+    if (m_alternate)
+    {
+        if (c == '\n')
+            m_screen.newline();
+        else
+            m_screen.write(Cell(c.unicode(), m_style));
 
-    vline &v = m_vlines[m_cursorLine];
-    Q_ASSERT(m_cursorCol <= v.len);
+        return;
+    }
 
-    int lineNumber = v.line;
+    Q_ASSERT(m_cursorLine < m_lines.numLines());
+    Q_ASSERT(m_cursorCol <= m_lines.length(m_cursorLine));
 
-    // Handle a newline
+    // Handle a newline by moving to the start of the next vline. That's
+    // either the next wrapped part of the cursor's line, or the next line
     if (c == '\n')
     {
+        int next = cursorVlineBeg() + m_numColsVisible;
+
+        if (m_numColsVisible > 0 && next <= m_lines.length(m_cursorLine))
+        {
+            m_cursorCol = next;
+            return;
+        }
+
         ++m_cursorLine;
         m_cursorCol = 0;
 
-        if (m_cursorLine == m_vlines.size())
+        if (m_cursorLine == m_lines.numLines())
         {
-            m_lines.append("");
-            m_vlines.append(vline(m_lines.size() - 1, 0, 0));
+            m_lines.appendLine();
+            m_index.appendLine(0);
         }
+
+        return;
     }
 
-    // Overwrite an old character
-    else if (m_cursorCol < v.len)
-    {
-        int cursorCol = v.beg + m_cursorCol;
-        m_lines[lineNumber][cursorCol] = c;
+    // Overwrite an old character, or append a new one
+    markDirty(m_cursorLine);
+    m_lines.setCell(m_cursorLine, m_cursorCol, Cell(c.unicode(), m_style));
 
-        ++m_cursorCol;
-    }
+    ++m_cursorCol;
+}
 
-    // Append a new character
-    else
+void History::writeRun(const QChar *text, int n)
+{
+    if (m_alternate)
     {
-        int cursorCol = v.beg + m_cursorCol;
-        m_lines[lineNumber].insert(cursorCol, c);
-
-        ++m_cursorCol;
-        ++v.len;
+        m_screen.write(text, n, m_style);
+        return;
     }
+
+    Q_ASSERT(m_cursorLine < m_lines.numLines());
+    Q_ASSERT(m_cursorCol <= m_lines.length(m_cursorLine));
+
+    // Canonical lines don't wrap, so the whole run goes into the cursor's
+    // line. Word wrap is applied later, from the line's new length
+    markDirty(m_cursorLine);
+    m_lines.write(m_cursorLine, m_cursorCol, text, n, m_style);
+
+    m_cursorCol += n;
 }
 
 void History::endWrite()
 {
-    wrapLines();
+    evict();
 
-    emit cursorMoved(m_cursorLine, m_cursorCol);
-    emit updated();
+    // Queries may come in at any time, even in the middle of a frame
+    syncIndex();
+
+    // The application is in the middle of a frame; tell views about it once
+    // the frame is done
+    if (m_synchronized)
+        return;
+
+    notify();
 }
 
-QChar History::charAt(int row, int col) const
+void History::notify()
 {
-    if (row >= m_vlines.size())
-        return ' ';
+    int row, col;
+    cursorPosition(&row, &col);
 
-    const vline &v = m_vlines[row];
-    if (col >= v.len)
-        return ' ';
+    // Let views repaint just the damaged part of the alternate screen. This
+    // goes out before the cursor moves, since the cursor was drawn into the
+    // pixels the view is about to shift. Anything that was held back gets
+    // a full update instead.
+    bool held = m_heldUpdated;
+    m_heldUpdated = false;
+
+    if (m_alternate && !held)
+    {
+        Screen::Damage d = m_screen.takeDamage();
+
+        if (!d.all)
+        {
+            emit screenUpdated(d.scrollTop, d.scrollBottom, d.scrolled,
+                               d.firstRow, d.lastRow);
+            emit cursorMoved(row, col);
+            return;
+        }
+    }
 
-    const QString &l = m_lines[v.line];
-    return l[v.beg + col];
+    emit cursorMoved(row, col);
+    emit updated();
 }
 
-int History::foregroundColorAt(int row, int col) const
+Cell History::cellAt(int row, int col) const
 {
-    /* XXX A faster way to do this would be to binary search through the gevent
-     * list looking for the foreground color change nearest the given row and
-     * column. However, this is complicated because the gevent list has some
-     * irrelevant events (e.g. those that change the background color rather
-     * than the foreground color). I'm not sure what a binary search should do
-     * upon hitting one of the irrelevant items -- we could search for the
-     * nearest event and scan backwards until we find a relevant event, but
-     * that could be worse than just walking the list. 
-     *
-     * For now I'm just going to walk the list. gevents occur pretty frequently
-     * though, so if this poses a performance issue we'll have to rethink our
-     * strategy. Same goes for backgroundColorAt()
-     */
-
-    int fg = 7;
-  
-    for (int i = 0; i < m_gevents.size(); ++i)
-    {
-        const gevent &g = m_gevents[i];
-        if (g.line > row || (g.line == row && g.col > col))
-            break;
+    if (m_alternate)
+        return m_screen.cell(row, col);
 
-        if (g.foreground)
-            fg = g.color;
-    }
+    if (row >= numLines())
+        return Cell();
 
-    return fg;
+    vline v = vlineAt(row);
+    if (col >= v.len)
+        return Cell();
+
+    return m_lines.cells(v.line)[v.beg + col];
 }
 
-int History::backgroundColorAt(int row, int col) const
+const Style &History::style(const Cell &cell) const
 {
-    int bg = 0;
+    return m_styles.style(cell.style);
+}
 
-    for (int i = 0; i < m_gevents.size(); ++i)
-    {
-        const gevent &g = m_gevents[i];
-        if (g.line > row || (g.line == row && g.col > col))
-            break;
+QChar History::charAt(int row, int col) const
+{
+    return QChar(cellAt(row, col).ch);
+}
 
-        if (!g.foreground)
-            bg = g.color;
-    }
+int History::foregroundColorAt(int row, int col) const
+{
+    return style(cellAt(row, col)).foreground;
+}
 
-    return bg;
+int History::backgroundColorAt(int row, int col) const
+{
+    return style(cellAt(row, col)).background;
 }
 
 QString History::line(int index) const
 {
-    if (index >= m_vlines.size())
+    if (index >= numLines())
         return QString();
 
-    const vline &v = m_vlines[index];
-    const QString &l = m_lines[v.line];
+    if (m_alternate)
+        return text(m_screen.row(index), m_screen.cols());
 
-    return l.mid(v.beg, v.len);
+    vline v = vlineAt(index);
+    return text(m_lines.cells(v.line) + v.beg, v.len);
 }
 
 QStringList History::visibleLines(int yTop, int yBottom, int lineHeight) const
 {
     int min = yTop / lineHeight,        // Row at top of viewport
-        max = yBottom / lineHeight;     // Row at bottom of viewport
+        max = yBottom / lineHeight,     // Row at bottom of viewport
+        n = numLines();
 
     QStringList ret;
-    for (int i = min; i < max && i < m_vlines.size(); ++i)
+    if (min >= n)
+        return ret;
+
+    if (m_alternate)
+    {
+        for (int i = min; i < max && i < n; ++i)
+            ret.append(text(m_screen.row(i), m_screen.cols()));
+
+        return ret;
+    }
+
+    vline v = vlineAt(min);
+
+    for (int i = min; i < max && i < n; ++i)
     {
-        const vline &v = m_vlines[i];
-        const QString &l = m_lines[v.line];
+        if (i > min)
+            v = nextVline(v);
 
-        ret.append(l.mid(v.beg, v.len));
+        ret.append(text(m_lines.cells(v.line) + v.beg, v.len));
     }
 
     return ret;
@@ -180,87 +218,31 @@ RenderData History::renderData(int yTop, int yBottom, int lineHeight) const
     int minLine = yTop / lineHeight,
         maxLine = yBottom / lineHeight;
 
-    if (minLine >= m_vlines.size())
+    int n = numLines();
+
+    if (minLine >= n)
         return RenderData(QVector<RenderData::Section>());
 
-    // Scan through gevents to find ...
-    int fg = 7,     // ... the current foreground color
-        bg = 0,     // ... the current background color
-        gindex = 0; // ... the index of the next gevent
+    // Walk through the visible lines, splitting them up into sections of
+    // cells that share the same style
+    QVector<RenderData::Section> sections;
 
-    for (int i = 0; i < m_gevents.size(); ++i)
+    if (m_alternate)
     {
-        const gevent &g = m_gevents[i];
-        const vline  &v = m_vlines[minLine];
+        for (int i = minLine; i < maxLine && i < n; ++i)
+            appendSections(&sections, i, m_screen.row(i), m_screen.cols());
 
-        if (g.line > v.line ||
-           (g.line == v.line && g.col > v.beg))
-        {
-            // This is the first gevent that occurs after the first visible
-            // character -- done scanning
-            gindex = i;
-            break;
-        }
-        else
-        {
-            if (g.foreground)
-                fg = g.color;
-            else
-                bg = g.color;
-        }
+        return RenderData(sections);
     }
 
-    // Walk through the visible lines, splitting them up into color sections
-    QVector<RenderData::Section> sections;
+    vline v = vlineAt(minLine);
 
-    for (int i = minLine; i < maxLine && i < m_vlines.size(); ++i)
+    for (int i = minLine; i < maxLine && i < n; ++i)
     {
-        const vline &v = m_vlines[i];
-        int vindex = v.beg;
-
-        // While there are unprocessed graphics changes within this vline,
-        // subdivide the vline and process the graphics changes
-        while (gindex < m_gevents.size() &&
-               m_gevents[gindex].line == v.line &&
-               m_gevents[gindex].col <= v.beg + v.len)
-        {
-            RenderData::Section s;
-            s.line = i;
-            s.foreground = fg;
-            s.background = bg;
-
-            gevent g = m_gevents[gindex];
-            s.data = m_lines[v.line].mid(vindex, g.col - vindex);
-            vindex = g.col;
-
-            sections.append(s);
-
-            while (g.col == vindex)
-            {
-                if (g.foreground)
-                    fg = g.color;
-                else
-                    bg = g.color;
-
-                ++gindex;
-                if (gindex >= m_gevents.size())
-                    break;
-
-                g = m_gevents[gindex];
-            }
-        }
+        if (i > minLine)
+            v = nextVline(v);
 
-        // No more graphics changes in the vline -- process the rest of it
-        if (vindex - v.beg <= v.len)
-        {
-            RenderData::Section s;
-            s.line = i;
-            s.data = m_lines[v.line].mid(vindex, v.len - (vindex - v.beg));
-            s.foreground = fg;
-            s.background = bg;
-
-            sections.append(s);
-        }
+        appendSections(&sections, i, m_lines.cells(v.line) + v.beg, v.len);
     }
 
     return RenderData(sections);
@@ -268,7 +250,10 @@ RenderData History::renderData(int yTop, int yBottom, int lineHeight) const
 
 int History::numLines() const
 {
-    return m_vlines.size();
+    if (m_alternate)
+        return m_screen.rows();
+
+    return m_index.numRows();
 }
 
 void History::onViewportResized(int numRowsVisible, int numColsVisible)
@@ -276,36 +261,96 @@ void History::onViewportResized(int numRowsVisible, int numColsVisible)
     m_numRowsVisible = numRowsVisible;
     m_numColsVisible = numColsVisible;
 
-    wrapLines();
+    m_index.setWidth(numColsVisible);
+    m_screen.resize(numRowsVisible, numColsVisible);
 
-    emit cursorMoved(m_cursorLine, m_cursorCol);
-    emit updated();
+    int row, col;
+    cursorPosition(&row, &col);
+
+    raiseCursorMoved(row, col);
+    raiseUpdated();
+}
+
+int History::maxLines() const
+{
+    return m_maxLines;
+}
+
+void History::setMaxLines(int lines)
+{
+    m_maxLines = lines;
+}
+
+bool History::spillToDisk() const
+{
+    return m_lines.spillToDisk();
+}
+
+void History::setSpillToDisk(bool spill)
+{
+    m_lines.setSpillToDisk(spill);
+}
+
+bool History::alternateScreen() const
+{
+    return m_alternate;
+}
+
+bool History::synchronizedOutput() const
+{
+    return m_synchronized;
+}
+
+void History::endSynchronizedOutput()
+{
+    if (!m_synchronized)
+        return;
+
+    setSynchronizedOutput(false);
+    notify();
 }
 
 void History::carriageReturn()
 {
-    m_cursorCol = 0;
-    emit cursorMoved(m_cursorLine, m_cursorCol);
+    if (m_alternate)
+    {
+        m_screen.setCursor(m_screen.cursorRow(), 0);
+        raiseCursorMoved(m_screen.cursorRow(), m_screen.cursorCol());
+        return;
+    }
+
+    m_cursorCol = cursorVlineBeg();
+
+    int row, col;
+    cursorPosition(&row, &col);
+
+    raiseCursorMoved(row, col);
 }
 
 void History::del(int n)
 {
-    Q_ASSERT(m_cursorLine < m_vlines.size());
+    if (m_alternate)
+    {
+        m_screen.del(n, blank());
+        return;
+    }
+
+    Q_ASSERT(m_cursorLine < m_lines.numLines());
 
-    const vline &v = m_vlines[m_cursorLine];
-    Q_ASSERT(m_cursorCol <= v.len);
+    int len = m_lines.length(m_cursorLine);
+    Q_ASSERT(m_cursorCol <= len);
 
-    if (m_cursorCol + n > v.len)
-        n = v.len - m_cursorCol;
+    if (m_cursorCol + n > len)
+        n = len - m_cursorCol;
 
-    m_lines[v.line].remove(v.beg + m_cursorCol, n);
-    m_vlines[m_cursorLine].len -= n;
+    markDirty(m_cursorLine);
+    m_lines.remove(m_cursorLine, m_cursorCol, n);
 }
 
 void History::erase(SpecialChars::EraseType type)
 {
     // The spec-correct behavior for this function is to actually delete data
-    // from m_lines and m_vlines. However, MinGW bash currently produces a
+    // from m_lines. However, MinGW bash currently produces a
     // sequence that would destructively erase all data when the user presses
     // Ctrl+L. That's kind of unacceptable.
     //
@@ -318,6 +363,15 @@ void History::erase(SpecialChars::EraseType type)
     //
     // Doing this properly in a non-destructive way is really hard btw :)
     // Check revision 3a655e7a5d463d01f9fcd05d4c0d8f9c99374123
+    //
+    // None of that applies to the alternate screen, which has no scrollback
+    // to preserve, so erase it for real.
+
+    if (m_alternate)
+    {
+        eraseScreen(type);
+        return;
+    }
 
     if (type == SpecialChars::ERASE_SCREEN ||
         type == SpecialChars::ERASE_SCREEN_BEFORE ||
@@ -327,7 +381,11 @@ void History::erase(SpecialChars::EraseType type)
     }
     else
     {
-        if (m_cursorLine != m_vlines.size() - 1)
+        int beg = cursorVlineBeg();
+
+        if (m_cursorLine != m_lines.numLines() - 1 ||
+            (m_numColsVisible > 0 &&
+             beg + m_numColsVisible <= m_lines.length(m_cursorLine)))
         {
             // We only support editing on the last line. Implementing erasure
             // on arbitrary lines would be possible, but that plus word wrap
@@ -336,48 +394,40 @@ void History::erase(SpecialChars::EraseType type)
             return;
         }
 
-        int lineIndex = m_lines.size() - 1,
-            vlineIndex = m_vlines.size() - 1;
+        // Since the cursor is on the last vline, that vline runs from beg to
+        // the end of the canonical line
+        markDirty(m_cursorLine);
 
         if (type == SpecialChars::ERASE_LINE)
         {
-            m_lines[lineIndex] = "";
-            m_vlines[vlineIndex].beg = 0;
-            m_vlines[vlineIndex].len = 0;
+            m_lines.truncate(m_cursorLine, 0);
+            m_cursorCol = 0;
         }
         else if (type == SpecialChars::ERASE_LINE_BEFORE)
         {
-            QString &l = m_lines[lineIndex];
-            vline &v = m_vlines[vlineIndex];
-
-            l = l.left(v.beg)                           // Before vline
-              + l.mid(v.beg + m_cursorCol,              // After cursor
-                      v.len - m_cursorCol)
-              + l.right(l.size() - (v.beg + v.len));    // After vline
-
-            v.len -= m_cursorCol;
-            m_cursorCol = 0;
+            m_lines.remove(m_cursorLine, beg, m_cursorCol - beg);
+            m_cursorCol = beg;
         }
         else if (type == SpecialChars::ERASE_LINE_AFTER)
         {
-            QString &l = m_lines[lineIndex];
-            vline &v = m_vlines[vlineIndex];
-
-            l = l.left(v.beg)                           // Before vline
-              + l.mid(v.beg, m_cursorCol)               // Before cursor
-              + l.right(l.size() - (v.beg + v.len));    // After vline
-
-            v.len = m_cursorCol;
+            m_lines.truncate(m_cursorLine, m_cursorCol);
         }
     }
 }
 
 void History::formFeed()
 {
+    if (m_alternate)
+    {
+        m_screen.clear(blank());
+        m_screen.setCursor(0, 0);
+        return;
+    }
+
     for (int i = 0; i < m_numRowsVisible; ++i)
         write('\n');
 
-    emit scrollToBottom();
+    raiseScrollToBottom();
 }
 
 void History::horizontalTab()
@@ -388,7 +438,17 @@ void History::horizontalTab()
     // one cell on the screen.
 
     const int SPACES_PER_TAB = 8;
-    int nspaces = SPACES_PER_TAB - (m_cursorCol % SPACES_PER_TAB);
+
+    if (m_alternate)
+    {
+        int col = m_screen.cursorCol();
+        m_screen.setCursor(m_screen.cursorRow(),
+                           col + SPACES_PER_TAB - (col % SPACES_PER_TAB));
+        return;
+    }
+
+    int col = m_cursorCol - cursorVlineBeg(),
+        nspaces = SPACES_PER_TAB - (col % SPACES_PER_TAB);
 
     for (int i = 0; i < nspaces; ++i)
         write(' ');
@@ -396,105 +456,181 @@ void History::horizontalTab()
 
 void History::insert(int n)
 {
-    // Get the vline to edit
-    Q_ASSERT(m_cursorLine < m_vlines.size());
+    if (m_alternate)
+    {
+        m_screen.insert(n, blank());
+        return;
+    }
 
-    const vline &v = m_vlines[m_cursorLine];
-    Q_ASSERT(m_cursorCol <= v.len);
+    Q_ASSERT(m_cursorLine < m_lines.numLines());
+    Q_ASSERT(m_cursorCol <= m_lines.length(m_cursorLine));
 
     // Add n blanks to the line starting at the cursor
-    QString toInsert;
-    for (int i = 0; i < n; ++i)
-        toInsert += ' ';
-
-    m_lines[v.line].insert(v.beg + m_cursorCol, toInsert);
+    markDirty(m_cursorLine);
+    m_lines.insert(m_cursorLine, m_cursorCol, n, Cell(' ', m_style));
+}
 
-    // Update v.beg for subsequent lines that share this line
-    for (int i = m_cursorLine + 1;
-         i < m_vlines.size() && m_vlines[i].line == v.line;
-         ++i)
-    {
-        m_vlines[i].beg += n;
-    }
+void History::lineFeed()
+{
+    write('\n');
 }
 
 void History::moveCursorBy(int rowDelta, int colDelta)
 {
-    int row = m_cursorLine + rowDelta - (m_vlines.size() - 1 - m_numRowsVisible);
-    int col = m_cursorCol + colDelta;
+    if (m_alternate)
+    {
+        moveCursorTo(m_screen.cursorRow() + rowDelta,
+                     m_screen.cursorCol() + colDelta);
+        return;
+    }
+
+    int row, col;
+    cursorPosition(&row, &col);
+
+    row += rowDelta - (numLines() - 1 - m_numRowsVisible);
+    col += colDelta;
 
     moveCursorTo(row, col);
 }
 
 void History::moveCursorTo(int row, int col)
 {
+    if (m_alternate)
+    {
+        m_screen.setCursor(row >= 0 ? row : m_screen.cursorRow(),
+                           col >= 0 ? col : m_screen.cursorCol());
+
+        raiseCursorMoved(m_screen.cursorRow(), m_screen.cursorCol());
+        return;
+    }
+
+    int cursorRow, cursorCol;
+    cursorPosition(&cursorRow, &cursorCol);
+
     if (row >= 0)
     {
-        m_cursorLine = m_vlines.size() - 1
-                     - m_numRowsVisible
-                     + row;
-
-        if (m_cursorLine < 0)
-            m_cursorLine = 0;
-        else if (m_cursorLine >= m_vlines.size())
-            m_cursorLine = m_vlines.size() - 1;
+        cursorRow = numLines() - 1
+                  - m_numRowsVisible
+                  + row;
+
+        if (cursorRow < 0)
+            cursorRow = 0;
+        else if (cursorRow >= numLines())
+            cursorRow = numLines() - 1;
     }
 
     if (col >= 0)
-    {
-        m_cursorCol = col;
+        cursorCol = col;
 
-        const vline &v = m_vlines[m_cursorLine];
-        if (m_cursorCol < 0)
-            m_cursorCol = 0;
-        else if (m_cursorCol > v.len)
-            m_cursorCol = v.len;
-    }
+    vline v = vlineAt(cursorRow);
+    if (cursorCol < 0)
+        cursorCol = 0;
+    else if (cursorCol > v.len)
+        cursorCol = v.len;
+
+    m_cursorLine = v.line;
+    m_cursorCol = v.beg + cursorCol;
+
+    cursorPosition(&cursorRow, &cursorCol);
+    raiseCursorMoved(cursorRow, cursorCol);
+}
 
-    emit cursorMoved(m_cursorLine, m_cursorCol);
+void History::print(const QChar *text, int n)
+{
+    writeRun(text, n);
+}
+
+void History::resetStyle()
+{
+    m_pen = Style();
+    internPen();
 }
 
-void History::resetColors()
+void History::scroll(int nlines)
 {
-    setColor(SpecialChars::DEFAULT, false, true);
-    setColor(SpecialChars::DEFAULT, false, false);
+    // The scrollback has no fixed screen to scroll, so this only applies to
+    // the alternate screen
+    if (!m_alternate)
+        return;
+
+    if (nlines < 0)
+        m_screen.scrollUp(-nlines, blank());
+    else
+        m_screen.scrollDown(nlines, blank());
 }
 
-void History::setColor(SpecialChars::Color c, bool bright, bool foreground)
+void History::setAlternateScreen(bool enabled)
 {
-    int color = (int)c;
+    if (enabled == m_alternate)
+        return;
+
+    // The scrollback cursor is left where it is while the alternate screen is
+    // up, so switching back restores it along with everything else
+    m_alternate = enabled;
 
-    if (c == SpecialChars::DEFAULT)
+    if (enabled)
     {
-        if (foreground)
-            color = (int)SpecialChars::WHITE;
-        else
-            color = (int)SpecialChars::BLACK;
+        m_screen.resize(m_numRowsVisible, m_numColsVisible);
+        m_screen.clear(Cell());
+        m_screen.setScrollRegion(0, m_screen.rows());
     }
 
-    if (bright)
-        color += 8;
+    raiseScreenChanged();
+
+    int row, col;
+    cursorPosition(&row, &col);
 
-    setColor256(color, foreground);
+    raiseCursorMoved(row, col);
+    raiseUpdated();
 }
 
-void History::setColor256(int color, bool foreground)
+void History::setAttributes(int attributes, bool on)
 {
-    int line = m_vlines[m_cursorLine].line,
-        col  = m_vlines[m_cursorLine].beg + m_cursorCol;
+    if (on)
+        m_pen.attributes |= attributes;
+    else
+        m_pen.attributes &= ~attributes;
+
+    internPen();
+}
 
-    gevent g(line, col, foreground, color);
+void History::setColor(int color, bool foreground)
+{
+    if (foreground)
+        m_pen.foreground = color;
+    else
+        m_pen.background = color;
+
+    internPen();
+}
+
+void History::setScrollRegion(int top, int bottom)
+{
+    if (!m_alternate)
+        return;
 
-    // Go through the list backwards, and insert after the first existing
-    // gevent that is supposed to come before this gevent (We go backwards
-    // because we expect most gevents to insert near the end of the buffer)
-    int index = m_gevents.size();
-    while (index - 1 >= 0 && m_gevents[index - 1].compareTo(g) > 0)
+    if (bottom <= 0)
+        bottom = m_screen.rows();
+
+    m_screen.setScrollRegion(top, bottom);
+    raiseCursorMoved(m_screen.cursorRow(), m_screen.cursorCol());
+}
+
+void History::setSynchronizedOutput(bool enabled)
+{
+    if (enabled == m_synchronized)
+        return;
+
+    m_synchronized = enabled;
+
+    if (enabled)
     {
-        --index;
+        m_heldAlternate = m_alternate;
+        return;
     }
 
-    m_gevents.insert(index, g);
+    // The rest goes out with the endWrite() that ends this batch
+    releaseHeld();
 }
 
 void History::verticalTab()
@@ -503,39 +639,300 @@ void History::verticalTab()
         write('\t');
 }
 
-void History::wrapLines()
+void History::markDirty(int line)
+{
+    if (m_dirtyBegin == m_dirtyEnd)
+    {
+        m_dirtyBegin = line;
+        m_dirtyEnd = line + 1;
+    }
+    else
+    {
+        m_dirtyBegin = qMin(m_dirtyBegin, line);
+        m_dirtyEnd = qMax(m_dirtyEnd, line + 1);
+    }
+}
+
+void History::internPen()
 {
-    // Record the canonical location of the cursor
-    int cursorLine = m_vlines[m_cursorLine].line,
-        cursorCol  = m_vlines[m_cursorLine].beg + m_cursorCol;
+    m_style = m_styles.intern(m_pen);
 
-    // Replace the current vlines with a new list corresponding to the current
-    // canonical line list
-    m_vlines.clear();
+    if (m_style != 0 || m_pen == Style() || !m_styles.isFull())
+        return;
 
-    for (int i = 0; i < m_lines.size(); ++i)
+    // Out of ids. A sweep reads the cells of the newest lines and the style
+    // lists of older blocks, so it's not free: if nearly every id is still
+    // in use, make do with the default style for a while rather than
+    // sweeping again soon
+    if (m_sweepDelay > 0)
     {
-        const QString &line = m_lines[i];
+        --m_sweepDelay;
+        return;
+    }
 
-        int next = 0;
-        while (next <= line.size())
-        {
-            int count = qMin(m_numColsVisible, line.size() - next);
-            vline v(i, next, count);
+    if (collectStyles() < SWEEP_INTERVAL)
+        m_sweepDelay = SWEEP_INTERVAL;
 
-            m_vlines.append(v);
+    m_style = m_styles.intern(m_pen);
+}
 
-            // If this vline contains the cursor, update the cursor coords
-            if (i == cursorLine &&
-                next <= cursorCol &&
-                next + count >= cursorCol)
-            {
-                m_cursorLine = m_vlines.size() - 1;
-                m_cursorCol = cursorCol - v.beg;
-            }
+int History::collectStyles()
+{
+    QBitArray live(StyleTable::MAX_STYLES);
+    live.setBit(m_style);
 
-            next += m_numColsVisible;
-        }
+    m_lines.markStyles(&live);
+
+    // The alternate screen keeps its cells while it's not in use
+    for (int i = 0; i < m_screen.rows(); ++i)
+    {
+        const Cell *cells = m_screen.row(i);
+
+        for (int j = 0; j < m_screen.cols(); ++j)
+            live.setBit(cells[j].style);
     }
+
+    return m_styles.sweep(live);
+}
+
+void History::syncIndex()
+{
+    for (int i = m_dirtyBegin; i < m_dirtyEnd; ++i)
+        m_index.setLength(i, m_lines.length(i));
+
+    m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+void History::evict()
+{
+    // Lines can't be added while the alternate screen is up, and emitting
+    // rowsEvicted() would disturb the saved scroll position
+    if (m_maxLines <= 0 || m_alternate)
+        return;
+
+    int excess = m_lines.numLines() - m_maxLines;
+    if (excess < EVICT_LINES)
+        return;
+
+    // Drop as many whole chunks as we can without losing the cursor's line
+    int n = qMin(excess - excess % EVICT_LINES,
+                 m_cursorLine - m_cursorLine % EVICT_LINES);
+
+    if (n <= 0)
+        return;
+
+    syncIndex();
+    int rows = m_index.firstRow(n);
+
+    m_lines.removeFront(n);
+    m_index.removeFront(n);
+    m_cursorLine -= n;
+
+    raiseRowsEvicted(rows);
+}
+
+void History::raiseCursorMoved(int row, int col)
+{
+    if (!m_synchronized)
+        emit cursorMoved(row, col);
+}
+
+void History::raiseUpdated()
+{
+    if (m_synchronized)
+        m_heldUpdated = true;
+    else
+        emit updated();
+}
+
+void History::raiseScrollToBottom()
+{
+    if (m_synchronized)
+        m_heldScrollToBottom = true;
+    else
+        emit scrollToBottom();
+}
+
+void History::raiseRowsEvicted(int rows)
+{
+    if (m_synchronized)
+        m_heldEvicted += rows;
+    else
+        emit rowsEvicted(rows);
+}
+
+void History::raiseScreenChanged()
+{
+    if (!m_synchronized)
+        emit screenChanged(m_alternate);
 }
 
+void History::releaseHeld()
+{
+    // Rows are only evicted from the main screen: before switching away from
+    // it if the frame started there, otherwise after switching back. Keep
+    // that order, since views save and restore their scroll position when
+    // the screen changes
+    int evicted = m_heldEvicted;
+    bool bottom = m_heldScrollToBottom;
+
+    m_heldEvicted = 0;
+    m_heldScrollToBottom = false;
+
+    if (evicted > 0 && !m_heldAlternate)
+        emit rowsEvicted(evicted);
+
+    if (m_alternate != m_heldAlternate)
+    {
+        emit screenChanged(m_alternate);
+        m_heldUpdated = true;
+    }
+
+    if (evicted > 0 && m_heldAlternate)
+        emit rowsEvicted(evicted);
+
+    if (bottom)
+        emit scrollToBottom();
+}
+
+History::vline History::vlineAt(int row) const
+{
+    Q_ASSERT(row >= 0 && row < numLines());
+
+    int first,
+        line = m_index.lineAt(row, &first),
+        size = m_lines.length(line);
+
+    if (m_numColsVisible <= 0)
+        return vline(line, 0, size);
+
+    int beg = (row - first) * m_numColsVisible;
+    return vline(line, beg, qMin(m_numColsVisible, size - beg));
+}
+
+History::vline History::nextVline(const vline &v) const
+{
+    int size = m_lines.length(v.line);
+
+    if (m_numColsVisible <= 0)
+        return vline(v.line + 1, 0, m_lines.length(v.line + 1));
+
+    int beg = v.beg + m_numColsVisible;
+    if (beg <= size)
+        return vline(v.line, beg, qMin(m_numColsVisible, size - beg));
+
+    size = m_lines.length(v.line + 1);
+    return vline(v.line + 1, 0, qMin(m_numColsVisible, size));
+}
+
+int History::cursorVlineBeg() const
+{
+    if (m_numColsVisible <= 0)
+        return 0;
+
+    return m_cursorCol - (m_cursorCol % m_numColsVisible);
+}
+
+void History::cursorPosition(int *row, int *col)
+{
+    if (m_alternate)
+    {
+        *row = m_screen.cursorRow();
+        *col = m_screen.cursorCol();
+        return;
+    }
+
+    syncIndex();
+
+    int beg = cursorVlineBeg();
+
+    *row = m_index.firstRow(m_cursorLine);
+    *col = m_cursorCol - beg;
+
+    if (m_numColsVisible > 0)
+        *row += beg / m_numColsVisible;
+}
+
+QString History::text(const Cell *cells, int n)
+{
+    QString ret(n, ' ');
+    QChar *data = ret.data();
+
+    for (int i = 0; i < n; ++i)
+        data[i] = QChar(cells[i].ch);
+
+    return ret;
+}
+
+Cell History::blank() const
+{
+    return Cell(' ', m_style);
+}
+
+void History::eraseScreen(SpecialChars::EraseType type)
+{
+    int row = m_screen.cursorRow(),
+        col = m_screen.cursorCol(),
+        rows = m_screen.rows(),
+        cols = m_screen.cols();
+
+    Cell fill = blank();
+
+    switch (type)
+    {
+        case SpecialChars::ERASE_SCREEN_AFTER:
+            m_screen.fill(row, col, cols, fill);
+            for (int r = row + 1; r < rows; ++r)
+                m_screen.fill(r, 0, cols, fill);
+            break;
+
+        case SpecialChars::ERASE_SCREEN_BEFORE:
+            for (int r = 0; r < row; ++r)
+                m_screen.fill(r, 0, cols, fill);
+            m_screen.fill(row, 0, col + 1, fill);
+            break;
+
+        case SpecialChars::ERASE_SCREEN:
+            m_screen.clear(fill);
+            break;
+
+        case SpecialChars::ERASE_LINE_AFTER:
+            m_screen.fill(row, col, cols, fill);
+            break;
+
+        case SpecialChars::ERASE_LINE_BEFORE:
+            m_screen.fill(row, 0, col + 1, fill);
+            break;
+
+        case SpecialChars::ERASE_LINE:
+            m_screen.fill(row, 0, cols, fill);
+            break;
+    }
+}
+
+void History::appendSections(QVector<RenderData::Section> *sections,
+                             int line, const Cell *cells, int n) const
+{
+    int start = 0;
+
+    do
+    {
+        ushort id = (n > 0) ? cells[start].style : 0;
+
+        int end = start + 1;
+        while (end < n && cells[end].style == id)
+            ++end;
+
+        if (end > n)
+            end = n;
+
+        RenderData::Section s;
+        s.line = line;
+        s.data = text(cells + start, end - start);
+        s.style = m_styles.style(id);
+
+        sections->append(s);
+        start = end;
+    }
+    while (start < n);
+}
@@ -1,8 +1,14 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include "cell.h"
+#include "escapehandler.h"
+#include "lineindex.h"
 #include "renderdata.h"
+#include "screen.h"
+#include "scrollback.h"
 #include "specialchars.h"
+#include "styletable.h"
 
 #include <QObject>
 #include <QString>
@@ -10,9 +16,10 @@
 #include <QVector>
 
 /** Manages writing to and querying from scrollback history.
- *  This object also receives and processes most escape sequences. 
+ *  This object also receives and processes most escape sequences, as the
+ *  EscapeHandler of the terminal's SpecialChars object.
  */
-class History : public QObject
+class History : public QObject, public EscapeHandler
 {
     Q_OBJECT
 
@@ -20,20 +27,37 @@ public:
     History();
     ~History();
 
-    /** Sets up this history object to receive escape sequence signals from the
-     *  given escape-sequence handler
-     */
-    void connectTo(SpecialChars *chars) const;
-
     /** Must be called before you begin write()ing characters */
     void beginWrite();
 
     /** Writes the given character into the history buffer at the cursor */
     void write(QChar c);
 
+    /** Writes a run of n characters into the history buffer at the cursor,
+     *  as if each had been passed to write(). The run must not contain any
+     *  newlines.
+     *
+     *  This is the fast path for plain text: the cells are stored in bulk,
+     *  and the dirty range and cursor are updated once for the whole run.
+     */
+    void writeRun(const QChar *text, int n);
+
     /** Must be called after you finish write()ing characters */
     void endWrite();
 
+    /** Gets the cell at the given row and column. Returns a blank cell with
+     *  the default style if there is no character there. This method takes
+     *  word wrap into account.
+     *
+     *  This is a single lookup, so callers that need both the character and
+     *  the colors of a cell (e.g. the Cursor) should prefer it over calling
+     *  charAt() and the color methods separately.
+     */
+    Cell cellAt(int row, int col) const;
+
+    /** Gets the style (colors) referenced by the given cell */
+    const Style &style(const Cell &cell) const;
+
     /** Gets the character at the given row and column. Returns the space
      *  character (' ') if there is no character in the given cell. This method
      *  takes word wrap into account.
@@ -42,13 +66,15 @@ public:
      */
     QChar charAt(int row, int col) const;
 
-    /** Gets the color palette index of the foreground color of the character
-     *  at the given row and column. This method takes word wrap into account.
+    /** Gets the foreground color of the character at the given row and
+     *  column, as a palette index or a Style::rgb() color. This method takes
+     *  word wrap into account.
      */
     int foregroundColorAt(int row, int col) const;
 
-    /** Gets the color palette index of the background color of the character
-     *  at the given row and column. This method takes word wrap into account.
+    /** Gets the background color of the character at the given row and
+     *  column, as a palette index or a Style::rgb() color. This method takes
+     *  word wrap into account.
      */
     int backgroundColorAt(int row, int col) const;
 
@@ -85,13 +111,56 @@ public:
 
     /** Must be called when the viewport is resized horizontally.
      *
-     *  This method performs a word-wrap on the original data received from the
-     *  shell to fit the new width of the viewport.
+     *  This method word-wraps the original data received from the shell to
+     *  fit the new width of the viewport. The wrap is computed lazily: only
+     *  the rows that are actually queried get mapped to the new width up
+     *  front.
      *
      *  This method also caches the number of rows and columns visible, which
      *  is needed in order to process some escape sequences (e.g. scrolling)
      */
     void onViewportResized(int numRowsVisible, int numColsVisible);
+
+    /** Gets or sets the maximum number of canonical lines of scrollback to
+     *  keep. A value of zero or less keeps everything.
+     *
+     *  Old lines are dropped in chunks of EVICT_LINES when a write batch ends,
+     *  so the buffer may temporarily hold up to EVICT_LINES - 1 lines over
+     *  the limit. The line containing the cursor is never dropped.
+     */
+    int maxLines() const;
+    void setMaxLines(int lines);
+
+    /** The default value of maxLines() */
+    static const int DEFAULT_MAX_LINES = 10000;
+
+    /** Gets or sets whether old scrollback is spilled to a temporary file
+     *  instead of being kept in memory. This is meant to be combined with an
+     *  unlimited maxLines(), so scrollback is bounded by disk space rather
+     *  than RAM. The file is deleted when this History is destroyed.
+     */
+    bool spillToDisk() const;
+    void setSpillToDisk(bool spill);
+
+    /** Returns true if the alternate screen is active. While it is, every
+     *  query and escape sequence applies to a fixed grid the size of the
+     *  viewport instead of to the scrollback, which is left untouched.
+     */
+    bool alternateScreen() const;
+
+    /** Returns true while the shell has asked for synchronized output (DEC
+     *  private mode 2026). While it has, every signal is held back until the
+     *  application resets the mode, so views never see half of a redraw.
+     *  Queries still work, but show the redraw in progress.
+     */
+    bool synchronizedOutput() const;
+
+    /** Ends synchronized output without waiting for the application, and
+     *  raises the signals endWrite() held back. Meant for applications that
+     *  set the mode and then never reset it. Does nothing if synchronized
+     *  output isn't on.
+     */
+    void endSynchronizedOutput();
     
 signals:
     /** Raised whenever an input event or escape sequence causes the cursor to
@@ -113,9 +182,34 @@ signals:
      */
     void scrollToBottom();
 
-private slots:
-    /** Slots activated by a SpecialChars object specified in a connectTo()
-     *  call. See specialchars.h for details about the individual signals.
+    /** Raised when old lines are dropped from the top of the buffer to stay
+     *  within maxLines(). Every row number (including the cursor's) moves up
+     *  by the given amount; views should shift their scroll position to match
+     *
+     *  @param rows The number of rows (vlines) that were removed
+     */
+    void rowsEvicted(int rows);
+
+    /** Raised when switching to or from the alternate screen. Row numbers
+     *  refer to a different buffer afterwards, so views should save their
+     *  scroll position when entering the alternate screen and restore it when
+     *  leaving
+     */
+    void screenChanged(bool alternate);
+
+    /** Raised instead of updated() at the end of a write to the alternate
+     *  screen, describing which part of it changed. Views should first shift
+     *  the pixels of the rows [top, bottom) up by the given number of rows
+     *  (down if negative), and then repaint the rows [firstRow, lastRow]. An
+     *  empty range is given by lastRow < firstRow.
+     */
+    void screenUpdated(int top, int bottom, int scrolled,
+                       int firstRow, int lastRow);
+
+private:
+    /** EscapeHandler implementation, called by the SpecialChars object that
+     *  was given this history. See escapehandler.h for details about the
+     *  individual methods.
      *
      *  Note: these handlers are all implemented assuming they were called
      *  inside a beginWrite / endWrite block.
@@ -127,14 +221,19 @@ private slots:
     void formFeed();
     void horizontalTab();
     void insert(int n);
+    void lineFeed();
     void moveCursorBy(int rowDelta, int colDelta);
     void moveCursorTo(int row, int col);
-    void resetColors();
-    void setColor(SpecialChars::Color c, bool bright, bool foreground);
-    void setColor256(int index, bool foreground);
+    void print(const QChar *text, int n);
+    void resetStyle();
+    void scroll(int nlines);
+    void setAlternateScreen(bool enabled);
+    void setAttributes(int attributes, bool on);
+    void setColor(int color, bool foreground);
+    void setScrollRegion(int top, int bottom);
+    void setSynchronizedOutput(bool enabled);
     void verticalTab();
 
-private:
     /** Description of a "virtual line" or vline. 
      *
      *  Each line of text received from the shell corresponds to one or more
@@ -142,8 +241,8 @@ private:
      *  size. 
      *
      *  The History object contains a list of (unchanged, original) lines 
-     *  received from the shell, as well as a list of vlines, which is thrown 
-     *  away and recomputed whenever the viewport size changes.
+     *  received from the shell. vlines are not stored; they are computed on
+     *  demand from m_index, which maps vline numbers to canonical lines.
      */
     struct vline
     {
@@ -151,79 +250,49 @@ private:
         vline(int line, int beg, int len) : line(line), beg(beg), len(len) { }
 
         /** The canonical line number this vline corresponds to.
-         *  This is NOT the virtual line number -- instead, use the index of
-         *  this vline into m_vlines
+         *  This is NOT the virtual line number
          */
         int line;
 
-        /** The index into m_lines[this->line] that this vline begins */
+        /** The index into canonical line this->line that this vline begins */
         int beg;
 
         /** The length of this virtual line */
         int len;
     };
 
-    /** Description of a graphics event */
-    struct gevent
-    {
-        gevent() : line(0), col(0), foreground(false), color(0) { }
-        gevent(int line, int col, bool fg, int color) 
-            : line(line), col(col), foreground(fg), color(color)
-        { }
-
-        /** The canonical line number this event occured on
-         *  This indexes into m_lines, not m_vlines
-         */
-        int line;
-
-        /** The index into m_lines[this->line] this event occurred */
-        int col;
-
-        /** True if this event modified the foreground color;
-         *  false if this event modified the background color
-         */
-        bool foreground;
-
-        /** The color palette index of this event, using the xterm-256 color
-         *  palette scheme
-         */
-        int color;
-
-        /** Returns ...
-         *    < 0 if this gevent is lexically before the other,
-         *      0 if this gevent is lexically the same as the other,
-         *    > 0 if this gevent is lexically after the other
-         */
-        int compareTo(const gevent &other) 
-        { 
-            return (line == other.line) 
-                 ? (col - other.col) 
-                 : (line - other.line); 
-        }
-    };
-
     /** The list of canonical lines
      *
      *  The item at the i'th index of this list is the i'th line of text, as
      *  received from the shell. This contains the list of lines as they would
-     *  be rendered if the viewport were infinitely large.
+     *  be rendered if the viewport were infinitely large. Each cell carries
+     *  its own style id, so colors travel with the text they were applied to.
      */
-    QVector<QString>    m_lines;
+    Scrollback          m_lines;
 
-    /** The list of word-wrapped lines.
+    /** Maps vline numbers to canonical lines and back.
      *  See the description of the vline struct
      */
-    QVector<vline>      m_vlines;
+    LineIndex           m_index;
+
+    /** The set of distinct styles referenced by the cells in m_lines */
+    StyleTable          m_styles;
+
+    /** The style applied to newly written cells, and its id in m_styles */
+    Style               m_pen;
+    ushort              m_style;
 
-    /** The list of graphics events
-     *  See the description of the gevent struct
+    /** The number of new styles to give the default style before sweeping
+     *  m_styles again, after a sweep that freed fewer than SWEEP_INTERVAL
+     *  ids. See internPen()
      */
-    QVector<gevent>     m_gevents;
+    int                 m_sweepDelay;
+    static const int    SWEEP_INTERVAL = 4096;
 
-    /** The virtual line number of the user's cursor */
+    /** The canonical line number of the user's cursor */
     int                 m_cursorLine;
 
-    /** The index into the virtual line of this user's cursor */
+    /** The index into the canonical line of the user's cursor */
     int                 m_cursorCol;
 
     /** The height of the viewport in rows */
@@ -232,8 +301,114 @@ private:
     /** The width of the viewport in columns */
     int                 m_numColsVisible;
 
-    /** Recomputes m_vlines based on m_lines and m_numVisibleCols */
-    void wrapLines();
+    /** The range [m_dirtyBegin, m_dirtyEnd) of canonical lines modified
+     *  since m_index was last updated. Writes only mark lines dirty; the new
+     *  lengths are pushed to the index in bulk by syncIndex().
+     */
+    int                 m_dirtyBegin;
+    int                 m_dirtyEnd;
+
+    /** See maxLines() */
+    int                 m_maxLines;
+
+    /** The number of lines evicted at a time. This is a multiple of both the
+     *  Scrollback and LineIndex block sizes, so eviction only ever drops
+     *  whole blocks.
+     */
+    static const int EVICT_LINES = LineIndex::BLOCK_SIZE;
+
+    /** The alternate screen, and whether it is active */
+    Screen              m_screen;
+    bool                m_alternate;
+
+    /** See synchronizedOutput() */
+    bool                m_synchronized;
+
+    /** Signals held back during synchronized output: whether updated() and
+     *  scrollToBottom() were raised, and the total of rowsEvicted(). Whether
+     *  to raise screenChanged() is decided by comparing m_alternate with its
+     *  value when the mode was set. cursorMoved() only needs the final
+     *  position, which notify() sends anyway
+     */
+    bool                m_heldUpdated;
+    bool                m_heldScrollToBottom;
+    int                 m_heldEvicted;
+    bool                m_heldAlternate;
+
+    /** Records that the given canonical line was modified */
+    void markDirty(int line);
+
+    /** Sets m_style to the id of m_pen. When m_styles is full, frees the
+     *  ids no cell refers to any more to make room
+     */
+    void internPen();
+
+    /** Frees every style id that isn't used by a cell or by the pen.
+     *  Returns the number of ids freed
+     */
+    int collectStyles();
+
+    /** Raises cursorMoved(), and updated() or screenUpdated(), for everything
+     *  written since the last call
+     */
+    void notify();
+
+    /** Raise the signals of the same names, or hold them back while
+     *  synchronized output is on
+     */
+    void raiseCursorMoved(int row, int col);
+    void raiseUpdated();
+    void raiseScrollToBottom();
+    void raiseRowsEvicted(int rows);
+    void raiseScreenChanged();
+
+    /** Raises the signals held back during synchronized output, except for
+     *  the ones notify() takes care of
+     */
+    void releaseHeld();
+
+    /** Updates m_index with the lengths of all dirty lines */
+    void syncIndex();
+
+    /** Drops lines from the top of the buffer until it is within maxLines() */
+    void evict();
+
+    /** Returns the vline at the given row. The row must be less than
+     *  numLines(), and m_index must be up to date.
+     */
+    vline vlineAt(int row) const;
+
+    /** Returns the vline after the given one. The given vline must not be the
+     *  last one.
+     */
+    vline nextVline(const vline &v) const;
+
+    /** Returns the index into the cursor's canonical line where the vline
+     *  containing the cursor begins
+     */
+    int cursorVlineBeg() const;
+
+    /** Computes the cursor's position in vline coordinates
+     *
+     *  @param row  Receives the row (vline number) of the cursor
+     *  @param col  Receives the column of the cursor within that vline
+     */
+    void cursorPosition(int *row, int *col);
+
+    /** Returns a blank cell in the current pen */
+    Cell blank() const;
+
+    /** Implements erase() for the alternate screen */
+    void eraseScreen(SpecialChars::EraseType type);
+
+    /** Splits a run of n cells into sections of cells with the same style,
+     *  and appends them to the given list for the given line
+     */
+    void appendSections(QVector<RenderData::Section> *sections,
+                        int line, const Cell *cells, int n) const;
+
+    /** Returns the characters in a run of n cells */
+    static QString text(const Cell *cells, int n);
 };
 
 #endif
@@ -0,0 +1,116 @@
+#include "inputqueue.h"
+
+#include <QMutexLocker>
+
+InputQueue::InputQueue()
+    : m_peeked(0)
+{ }
+
+InputQueue::~InputQueue() { }
+
+bool InputQueue::append(const QByteArray &data, Kind kind)
+{
+    if (data.isEmpty())
+        return true;
+
+    QMutexLocker lock(&m_mutex);
+
+    Queue &q = (kind == Typed) ? m_typed : m_pasted;
+    int max = (kind == Typed) ? MAX_TYPED : MAX_PASTED;
+
+    if (data.size() > max - q.size)
+        return false;
+
+    q.chunks.append(data);
+    q.size += data.size();
+
+    return true;
+}
+
+bool InputQueue::isEmpty() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_typed.size == 0 && m_pasted.size == 0;
+}
+
+const char *InputQueue::peek(int *n)
+{
+    QMutexLocker lock(&m_mutex);
+
+    // Typed input goes first, unless that would land in the middle of a
+    // character of the paste
+    bool split = pasteSplitsCharacter();
+
+    if (m_typed.size > 0 && !split)
+        m_peeked = &m_typed;
+    else if (m_pasted.size > 0)
+        m_peeked = &m_pasted;
+    else
+    {
+        m_peeked = 0;
+        *n = 0;
+        return 0;
+    }
+
+    // Appending to the list from another thread moves the byte arrays'
+    // handles around, but not the data they point to
+    const QByteArray &front = m_peeked->chunks.first();
+    int len = front.size() - m_peeked->offset;
+
+    if (m_peeked == &m_pasted)
+    {
+        if (len > CHUNK_SIZE)
+            len = CHUNK_SIZE;
+
+        // Only finish the character, so typed input can go next
+        if (split && m_typed.size > 0)
+        {
+            int end = m_peeked->offset;
+            while (end < front.size() && (front[end] & 0xC0) == 0x80)
+                ++end;
+
+            len = end - m_peeked->offset;
+        }
+    }
+
+    *n = len;
+    return front.constData() + m_peeked->offset;
+}
+
+void InputQueue::consume(int n)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (!m_peeked || n <= 0)
+        return;
+
+    Queue &q = *m_peeked;
+
+    q.offset += n;
+    q.size -= n;
+
+    if (q.offset == q.chunks.first().size())
+    {
+        q.chunks.removeFirst();
+        q.offset = 0;
+    }
+}
+
+void InputQueue::clear()
+{
+    QMutexLocker lock(&m_mutex);
+
+    m_typed = Queue();
+    m_pasted = Queue();
+    m_peeked = 0;
+}
+
+bool InputQueue::pasteSplitsCharacter() const
+{
+    if (m_pasted.size == 0 || m_pasted.offset == 0)
+        return false;
+
+    // UTF-8 continuation bytes look like 10xxxxxx
+    const QByteArray &front = m_pasted.chunks.first();
+    return (front[m_pasted.offset] & 0xC0) == 0x80;
+}
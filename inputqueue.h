@@ -0,0 +1,85 @@
+#ifndef INPUTQUEUE_H
+#define INPUTQUEUE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+/** Input waiting to be written to a shell.
+ *
+ *  Typed input and pasted input are queued separately. Typed input always
+ *  goes first, even in the middle of a paste, so e.g. Ctrl+C still gets
+ *  through while a large paste is being fed to a program that reads slowly.
+ *  Pastes are handed out a chunk at a time, and are only interrupted between
+ *  whole UTF-8 characters.
+ *
+ *  Both queues are bounded. Input that doesn't fit is refused as a whole
+ *  rather than cut off, so the caller can tell the user.
+ *
+ *  Any thread may append(); peek() and consume() must all be called from one
+ *  thread, normally the shell driver's I/O thread.
+ */
+class InputQueue
+{
+public:
+    enum Kind
+    {
+        Typed,
+        Pasted
+    };
+
+    InputQueue();
+    ~InputQueue();
+
+    /** Queues the given data. Returns false, and queues nothing, if there
+     *  isn't room for all of it
+     */
+    bool append(const QByteArray &data, Kind kind);
+
+    /** Returns true if there is nothing waiting to be written */
+    bool isEmpty() const;
+
+    /** Returns the next bytes to write, and sets *n to their number (zero if
+     *  the queue is empty). The data stays valid until consume() is called
+     */
+    const char *peek(int *n);
+
+    /** Removes the first n bytes returned by peek() from the queue */
+    void consume(int n);
+
+    /** Drops everything that is queued, e.g. because the shell exited */
+    void clear();
+
+    /** The most typed and pasted input that can be waiting at once, in
+     *  bytes, and the most of a paste peek() returns at a time
+     */
+    static const int MAX_TYPED = 64 * 1024;
+    static const int MAX_PASTED = 32 * 1024 * 1024;
+    static const int CHUNK_SIZE = 4096;
+
+private:
+    /** A queue of byte strings, the first of which may be partly written */
+    struct Queue
+    {
+        Queue() : offset(0), size(0) { }
+
+        QList<QByteArray> chunks;
+        int offset;
+        int size;
+    };
+
+    mutable QMutex m_mutex;
+
+    Queue m_typed;
+    Queue m_pasted;
+
+    /** The queue the last peek() returned data from */
+    Queue *m_peeked;
+
+    /** Returns true if the unwritten part of the paste starts in the middle
+     *  of a UTF-8 character
+     */
+    bool pasteSplitsCharacter() const;
+};
+
+#endif // INPUTQUEUE_H
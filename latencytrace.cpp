@@ -0,0 +1,234 @@
+#include "latencytrace.h"
+
+#include <QFile>
+#include <QMutexLocker>
+
+#include <string.h>
+
+bool LatencyTrace::s_enabled = false;
+
+static const char *STAGE_NAMES[] =
+{
+    "key->written",
+    "written->read",
+    "read->parsed",
+    "parsed->painted"
+};
+
+LatencyTrace::Histogram::Histogram()
+    : count(0),
+      max(0)
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+void LatencyTrace::Histogram::add(qint64 us)
+{
+    if (us < 0)
+        us = 0;
+    else if (us > MAX_LATENCY)
+        us = MAX_LATENCY;
+
+    ++counts[bucket(us)];
+    ++count;
+
+    if (us > max)
+        max = us;
+}
+
+qint64 LatencyTrace::Histogram::percentile(double p) const
+{
+    if (count == 0)
+        return 0;
+
+    // The smallest latency that at least p of the samples don't exceed
+    qint64 rank = qint64(p * count + 0.999999),
+           seen = 0;
+
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+    {
+        seen += counts[i];
+
+        if (seen >= rank)
+        {
+            qint64 end = bucketEnd(i) - 1;
+            return end < max ? end : max;
+        }
+    }
+
+    return max;
+}
+
+int LatencyTrace::Histogram::bucket(qint64 us)
+{
+    if (us < 16)
+        return us;
+
+    // Keep the top four bits: the exponent picks a group of eight buckets,
+    // the three bits below the leading one pick a bucket within the group
+    int msb = 4;
+    while (us >> (msb + 1))
+        ++msb;
+
+    int shift = msb - 3;
+    return 16 + (msb - 4) * 8 + int((us >> shift) - 8);
+}
+
+qint64 LatencyTrace::Histogram::bucketEnd(int bucket)
+{
+    if (bucket < 16)
+        return bucket + 1;
+
+    int k = bucket - 16,
+        shift = k / 8 + 1;
+
+    return qint64(k % 8 + 9) << shift;
+}
+
+LatencyTrace::LatencyTrace()
+    : m_next(KeyPressed),
+      m_batch(0)
+{
+    memset(m_times, 0, sizeof(m_times));
+}
+
+LatencyTrace &LatencyTrace::instance()
+{
+    static LatencyTrace trace;
+    return trace;
+}
+
+void LatencyTrace::start(const QString &path)
+{
+    LatencyTrace &t = instance();
+    t.m_path = path;
+    t.m_clock.start();
+
+    s_enabled = true;
+}
+
+void LatencyTrace::record(Point point, int batch)
+{
+    // Shell output and parsed batches go by all the time; don't lock for
+    // the ones no trace is waiting for
+    LatencyTrace &t = instance();
+
+    if (point != KeyPressed && t.m_next.loadAcquire() != point)
+        return;
+
+    QMutexLocker lock(&t.m_mutex);
+
+    qint64 now = t.m_clock.nsecsElapsed();
+    int next = t.m_next.load();
+
+    if (point == KeyPressed)
+    {
+        if (next != KeyPressed
+            && now - t.m_times[KeyPressed] < qint64(TIMEOUT) * 1000000)
+        {
+            return;
+        }
+
+        t.m_times[KeyPressed] = now;
+        t.m_next.storeRelease(InputWritten);
+        return;
+    }
+
+    if (next != point)
+        return;
+
+    // Cursor blinks, exposes and frames from before the batch don't show
+    // the output yet
+    if (point == Painted && batch - t.m_batch < 0)
+        return;
+
+    if (point == OutputParsed)
+        t.m_batch = batch;
+
+    t.m_times[point] = now;
+    t.m_stages[point - 1].add((now - t.m_times[point - 1]) / 1000);
+
+    if (point == Painted)
+    {
+        t.m_total.add((now - t.m_times[KeyPressed]) / 1000);
+        t.m_next.storeRelease(KeyPressed);
+    }
+    else
+    {
+        t.m_next.storeRelease(point + 1);
+    }
+}
+
+bool LatencyTrace::dump()
+{
+    if (!s_enabled)
+        return false;
+
+    LatencyTrace &t = instance();
+
+    Histogram stages[NUM_POINTS], *total = &stages[NUM_POINTS - 1];
+    const char *names[NUM_POINTS];
+
+    {
+        QMutexLocker lock(&t.m_mutex);
+
+        for (int i = 0; i < NUM_POINTS - 1; ++i)
+        {
+            stages[i] = t.m_stages[i];
+            names[i] = STAGE_NAMES[i];
+        }
+
+        *total = t.m_total;
+        names[NUM_POINTS - 1] = "total";
+    }
+
+    QByteArray out;
+    char line[128];
+
+    qsnprintf(line, sizeof(line),
+              "# Keypress-to-pixel latency in microseconds, %lld traces\n"
+              "%-16s %10s %10s %10s %10s\n",
+              (long long)total->count, "stage", "count", "p50", "p99", "max");
+    out += line;
+
+    for (int i = 0; i < NUM_POINTS; ++i)
+    {
+        qsnprintf(line, sizeof(line), "%-16s %10lld %10lld %10lld %10lld\n",
+                  names[i],
+                  (long long)stages[i].count,
+                  (long long)stages[i].percentile(0.50),
+                  (long long)stages[i].percentile(0.99),
+                  (long long)stages[i].max);
+        out += line;
+    }
+
+    // The non-empty buckets, for plotting: stage, upper bound, count
+    out += "\n# stage, bucket end (us, exclusive), count\n";
+
+    for (int i = 0; i < NUM_POINTS; ++i)
+    {
+        for (int b = 0; b < Histogram::NUM_BUCKETS; ++b)
+        {
+            if (stages[i].counts[b] == 0)
+                continue;
+
+            qsnprintf(line, sizeof(line), "%s %lld %lld\n",
+                      names[i],
+                      (long long)Histogram::bucketEnd(b),
+                      (long long)stages[i].counts[b]);
+            out += line;
+        }
+    }
+
+    QFile file(t.m_path);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || file.write(out) != out.size())
+    {
+        qWarning("Could not write latency histograms to %s",
+                 qPrintable(t.m_path));
+        return false;
+    }
+
+    return true;
+}
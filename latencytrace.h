@@ -0,0 +1,129 @@
+#ifndef LATENCYTRACE_H
+#define LATENCYTRACE_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+
+/** Measures how long a keypress takes to show up on screen.
+ *
+ *  A key press starts a trace, which then follows the keystroke through the
+ *  rest of the pipeline: the driver writing it to the shell, the first read
+ *  of shell output after that (normally the echo), the Session finishing
+ *  the batch of output containing it, and the widget painting the first
+ *  frame that includes that batch. The
+ *  time between each pair of points is added to a histogram for that stage,
+ *  and the time from the key press to the paint to one for the whole trip.
+ *
+ *  Only one keystroke is traced at a time. Keys pressed while a trace is in
+ *  flight are not traced, unless that trace has been going for longer than
+ *  TIMEOUT milliseconds (e.g. the key didn't produce any output), in which
+ *  case it's abandoned.
+ *
+ *  Tracing is off unless start() is called, normally because LWT_LATENCY
+ *  was set in the environment; while it's off, mark() is an inline test of
+ *  a flag. Any thread may call mark().
+ */
+class LatencyTrace
+{
+public:
+    /** The points of a trace, in the order they are reached */
+    enum Point
+    {
+        KeyPressed,
+        InputWritten,
+        OutputRead,
+        OutputParsed,
+        Painted,
+
+        NUM_POINTS
+    };
+
+    /** Turns tracing on. dump() writes the histograms to the given file */
+    static void start(const QString &path);
+
+    /** Indicates whether start() was called */
+    static bool enabled() { return s_enabled; }
+
+    /** Records that the traced keystroke reached the given point. A
+     *  KeyPressed starts a new trace if none is in flight; any other point
+     *  is ignored unless it's the next one the trace is waiting for.
+     *
+     *  OutputParsed and Painted also take the number of the write batch
+     *  that was parsed, and that the painted frame goes up to (see
+     *  Frame::writes). A paint only counts once it includes the traced batch
+     */
+    static void mark(Point point, int batch = 0)
+    {
+        if (s_enabled)
+            record(point, batch);
+    }
+
+    /** Writes the p50, p99 and maximum latency of each stage, followed by
+     *  the histograms themselves, to the file given to start(). Returns
+     *  false if it couldn't be written
+     */
+    static bool dump();
+
+    /** How long a trace can wait for its next point before a new key press
+     *  replaces it, in milliseconds
+     */
+    static const int TIMEOUT = 5000;
+
+private:
+    /** Latencies in microseconds, in buckets that are each 1/8th of a power
+     *  of two wide (exact below 16us), so percentiles are accurate to within
+     *  about 12%. The maximum is exact. Anything over MAX_LATENCY counts as
+     *  MAX_LATENCY
+     */
+    struct Histogram
+    {
+        Histogram();
+
+        void add(qint64 us);
+        qint64 percentile(double p) const;
+
+        static int bucket(qint64 us);
+        static qint64 bucketEnd(int bucket);
+
+        static const qint64 MAX_LATENCY = (Q_INT64_C(1) << 40) - 1;
+        static const int NUM_BUCKETS = 16 + 36 * 8;
+
+        qint64 counts[NUM_BUCKETS];
+        qint64 count;
+        qint64 max;
+    };
+
+    LatencyTrace();
+
+    static LatencyTrace &instance();
+
+    /** Does the work of mark() while tracing is on */
+    static void record(Point point, int batch);
+
+    QString m_path;
+    QElapsedTimer m_clock;
+
+    /** The point the trace in flight is waiting for, or KeyPressed if there
+     *  isn't one. Checked before taking the lock, so points nobody's waiting
+     *  for are cheap to ignore
+     */
+    QAtomicInt m_next;
+
+    QMutex m_mutex;
+
+    /** When the trace in flight reached each point, in nanoseconds */
+    qint64 m_times[NUM_POINTS];
+
+    /** The write batch the traced output was parsed in */
+    int m_batch;
+
+    /** One histogram per stage between two points, and one for the total */
+    Histogram m_stages[NUM_POINTS - 1];
+    Histogram m_total;
+
+    static bool s_enabled;
+};
+
+#endif // LATENCYTRACE_H
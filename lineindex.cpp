@@ -0,0 +1,363 @@
+#include "lineindex.h"
+
+LineIndex::LineIndex()
+    : m_width(0),
+      m_widthGen(0),
+      m_numLines(0),
+      m_totalRows(0),
+      m_totalValid(true),
+      m_frontValid(0),
+      m_backValid(0)
+{ }
+
+LineIndex::~LineIndex() { }
+
+int LineIndex::width() const
+{
+    return m_width;
+}
+
+void LineIndex::setWidth(int cols)
+{
+    if (cols == m_width)
+        return;
+
+    // Don't recompute anything yet -- just mark every cached sum as stale.
+    // Block row counts check m_widthGen before they're used.
+    m_width = cols;
+    ++m_widthGen;
+
+    m_totalValid = false;
+    m_frontValid = 0;
+    m_backValid = 0;
+}
+
+int LineIndex::numLines() const
+{
+    return m_numLines;
+}
+
+int LineIndex::numRows() const
+{
+    if (!m_totalValid)
+    {
+        // Every line occupies at least one row. Lines shorter than the width
+        // don't wrap, so only lengths >= m_width add extra rows.
+        int total = m_numLines;
+
+        if (m_width > 0)
+        {
+            QMap<int, int>::const_iterator it;
+            for (it = m_lengthCounts.lowerBound(m_width);
+                 it != m_lengthCounts.constEnd();
+                 ++it)
+            {
+                total += it.value() * (it.key() / m_width);
+            }
+        }
+
+        m_totalRows = total;
+        m_totalValid = true;
+    }
+
+    return m_totalRows;
+}
+
+int LineIndex::rowsFor(int length) const
+{
+    if (m_width <= 0)
+        return 1;
+
+    return length / m_width + 1;
+}
+
+void LineIndex::appendLine(int length)
+{
+    if (m_blocks.isEmpty() || m_blocks.last().lengths.size() == BLOCK_SIZE)
+    {
+        Block b;
+        b.rowsGen = m_widthGen;
+        b.lengths.reserve(BLOCK_SIZE);
+
+        m_blocks.append(b);
+    }
+
+    int block = m_blocks.size() - 1,
+        rows = rowsFor(length);
+
+    Block &b = m_blocks[block];
+    b.lengths.append(length);
+
+    if (b.rowsGen == m_widthGen)
+        b.rows += rows;
+
+    ++m_numLines;
+    countLength(-1, length);
+
+    if (m_totalValid)
+        m_totalRows += rows;
+
+    blockChanged(block, rows);
+}
+
+void LineIndex::removeFront(int n)
+{
+    Q_ASSERT(n >= 0 && n <= m_numLines && n % BLOCK_SIZE == 0);
+
+    for (int i = 0; i < n / BLOCK_SIZE; ++i)
+    {
+        const Block &b = m_blocks.first();
+
+        if (m_totalValid)
+            m_totalRows -= blockRows(0);
+
+        for (int j = 0; j < b.lengths.size(); ++j)
+            countLength(b.lengths[j], 0);
+
+        m_numLines -= b.lengths.size();
+        m_blocks.removeFirst();
+    }
+
+    if (n == 0)
+        return;
+
+    // Every remaining prefix sum is now off by the rows that were removed.
+    // Rather than patch them all, drop the front region and let it regrow on
+    // demand. Suffix sums don't depend on anything before them, so the back
+    // region stays valid.
+    m_frontValid = 0;
+    m_backValid = qMin(m_backValid, m_blocks.size());
+}
+
+int LineIndex::length(int line) const
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    return m_blocks[line / BLOCK_SIZE].lengths[line % BLOCK_SIZE];
+}
+
+void LineIndex::setLength(int line, int length)
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    int block = line / BLOCK_SIZE;
+    Block &b = m_blocks[block];
+
+    int &len = b.lengths[line % BLOCK_SIZE];
+    if (len == length)
+        return;
+
+    int delta = rowsFor(length) - rowsFor(len);
+
+    countLength(len, length);
+    len = length;
+
+    if (delta == 0)
+        return;
+
+    if (b.rowsGen == m_widthGen)
+        b.rows += delta;
+
+    if (m_totalValid)
+        m_totalRows += delta;
+
+    blockChanged(block, delta);
+}
+
+int LineIndex::firstRow(int line) const
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    int block = line / BLOCK_SIZE,
+        row = blockStart(block);
+
+    const Block &b = m_blocks[block];
+    for (int i = 0; i < line % BLOCK_SIZE; ++i)
+        row += rowsFor(b.lengths[i]);
+
+    return row;
+}
+
+int LineIndex::lineAt(int row, int *first) const
+{
+    Q_ASSERT(row >= 0 && row < numRows());
+
+    int nblocks = m_blocks.size(),
+        block = -1,
+        start = 0;
+
+    while (block < 0)
+    {
+        int frontEnd = 0,
+            backStart = numRows();
+
+        if (m_frontValid > 0)
+        {
+            const Block &b = m_blocks[m_frontValid - 1];
+            frontEnd = b.prefix + blockRows(m_frontValid - 1);
+        }
+
+        if (m_backValid > 0)
+            backStart -= m_blocks[nblocks - m_backValid].suffix;
+
+        if (row < frontEnd)
+        {
+            // Binary search for the last front block starting at or before
+            // the row
+            int lo = 0,
+                hi = m_frontValid - 1;
+
+            while (lo < hi)
+            {
+                int mid = (lo + hi + 1) / 2;
+                if (m_blocks[mid].prefix <= row)
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+
+            block = lo;
+            start = m_blocks[lo].prefix;
+        }
+        else if (row >= backStart)
+        {
+            // Same thing for the back region, where a block starts at
+            // (total - suffix)
+            int total = numRows(),
+                lo = nblocks - m_backValid,
+                hi = nblocks - 1;
+
+            while (lo < hi)
+            {
+                int mid = (lo + hi + 1) / 2;
+                if (total - m_blocks[mid].suffix <= row)
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+
+            block = lo;
+            start = total - m_blocks[lo].suffix;
+        }
+        else if (row - frontEnd <= backStart - row)
+        {
+            extendFront();
+        }
+        else
+        {
+            extendBack();
+        }
+    }
+
+    // Walk the block to find the line containing the row
+    const Block &b = m_blocks[block];
+    for (int i = 0; i < b.lengths.size(); ++i)
+    {
+        int rows = rowsFor(b.lengths[i]);
+        if (row < start + rows)
+        {
+            if (first)
+                *first = start;
+
+            return block * BLOCK_SIZE + i;
+        }
+
+        start += rows;
+    }
+
+    Q_ASSERT(false);
+    return m_numLines - 1;
+}
+
+int LineIndex::blockRows(int block) const
+{
+    const Block &b = m_blocks[block];
+
+    if (b.rowsGen != m_widthGen)
+    {
+        int rows = 0;
+        for (int i = 0; i < b.lengths.size(); ++i)
+            rows += rowsFor(b.lengths[i]);
+
+        b.rows = rows;
+        b.rowsGen = m_widthGen;
+    }
+
+    return b.rows;
+}
+
+int LineIndex::blockStart(int block) const
+{
+    int nblocks = m_blocks.size();
+
+    for (;;)
+    {
+        if (block < m_frontValid)
+            return m_blocks[block].prefix;
+
+        if (block >= nblocks - m_backValid)
+            return numRows() - m_blocks[block].suffix;
+
+        // Grow whichever region is closer to the block
+        if (block - m_frontValid <= nblocks - m_backValid - 1 - block)
+            extendFront();
+        else
+            extendBack();
+    }
+}
+
+void LineIndex::extendFront() const
+{
+    int block = m_frontValid;
+    Q_ASSERT(block < m_blocks.size());
+
+    const Block &b = m_blocks[block];
+
+    if (block == 0)
+        b.prefix = 0;
+    else
+        b.prefix = m_blocks[block - 1].prefix + blockRows(block - 1);
+
+    ++m_frontValid;
+}
+
+void LineIndex::extendBack() const
+{
+    int block = m_blocks.size() - 1 - m_backValid;
+    Q_ASSERT(block >= 0);
+
+    const Block &b = m_blocks[block];
+
+    b.suffix = blockRows(block);
+    if (block + 1 < m_blocks.size())
+        b.suffix += m_blocks[block + 1].suffix;
+
+    ++m_backValid;
+}
+
+void LineIndex::blockChanged(int block, int delta)
+{
+    if (delta == 0)
+        return;
+
+    // Blocks up to and including this one still have the same prefix, and
+    // blocks after it still have the same suffix
+    m_frontValid = qMin(m_frontValid, block + 1);
+    m_backValid = qMin(m_backValid, m_blocks.size() - block - 1);
+}
+
+void LineIndex::countLength(int oldLength, int newLength)
+{
+    // Empty lines never wrap, so there's no need to count them
+    if (oldLength > 0)
+    {
+        QMap<int, int>::iterator it = m_lengthCounts.find(oldLength);
+        Q_ASSERT(it != m_lengthCounts.end());
+
+        if (--it.value() == 0)
+            m_lengthCounts.erase(it);
+    }
+
+    if (newLength > 0)
+        ++m_lengthCounts[newLength];
+}
@@ -0,0 +1,149 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <QList>
+#include <QMap>
+#include <QVector>
+
+/** Maps between canonical lines and word-wrapped rows ("vlines").
+ *
+ *  A canonical line of length len occupies (len / width + 1) rows when
+ *  word-wrapped to the given width, so the index only needs to store line
+ *  lengths. Lengths are grouped into fixed-size blocks, and each block caches
+ *  its row count along with the number of rows before it (a block prefix
+ *  sum). Finding the line that contains a row is then a binary search over the
+ *  blocks followed by a short walk within one block.
+ *
+ *  Everything derived from the width is computed lazily. Changing the width
+ *  only bumps a generation counter; the total row count is recomputed from a
+ *  histogram of line lengths, and block prefix sums are rebuilt on demand,
+ *  inward from whichever end of the buffer a query lands closest to. Looking
+ *  up the rows at the bottom of the buffer right after a resize therefore
+ *  costs O(visible) rather than O(history).
+ */
+class LineIndex
+{
+public:
+    /** The number of lines per block */
+    static const int BLOCK_SIZE = 256;
+
+    LineIndex();
+    ~LineIndex();
+
+    /** Gets or sets the width in columns that lines are wrapped to. A width
+     *  of zero or less disables wrapping.
+     */
+    int width() const;
+    void setWidth(int cols);
+
+    /** Returns the number of canonical lines in the index */
+    int numLines() const;
+
+    /** Returns the number of rows all lines occupy after wrapping */
+    int numRows() const;
+
+    /** Returns the number of rows a line of the given length occupies */
+    int rowsFor(int length) const;
+
+    /** Adds a line of the given length to the end of the index */
+    void appendLine(int length);
+
+    /** Removes the first n lines from the index. n must be a multiple of
+     *  BLOCK_SIZE, so this only ever drops whole blocks.
+     */
+    void removeFront(int n);
+
+    /** Gets or sets the length of the given canonical line */
+    int length(int line) const;
+    void setLength(int line, int length);
+
+    /** Returns the index of the first row the given canonical line occupies */
+    int firstRow(int line) const;
+
+    /** Returns the canonical line that occupies the given row
+     *
+     *  @param row      The row to look up. Must be less than numRows()
+     *  @param first    If non-null, receives the index of the first row the
+     *                  returned line occupies
+     */
+    int lineAt(int row, int *first = 0) const;
+
+private:
+    /** A run of BLOCK_SIZE consecutive lines (the last block may be shorter).
+     *
+     *  The cached fields are only meaningful while their generation stamp
+     *  matches m_widthGen; see the region description on m_frontValid.
+     */
+    struct Block
+    {
+        Block() : rows(0), rowsGen(-1), prefix(0), suffix(0) { }
+
+        /** The length of each line in this block */
+        QVector<int>    lengths;
+
+        /** The number of rows the lines in this block occupy */
+        mutable int     rows;
+
+        /** The value of m_widthGen when rows was computed */
+        mutable int     rowsGen;
+
+        /** The number of rows before this block. Valid while this block is
+         *  in the front region
+         */
+        mutable int     prefix;
+
+        /** The number of rows in this block and all blocks after it. Valid
+         *  while this block is in the back region
+         */
+        mutable int     suffix;
+    };
+
+    /** A QList so whole blocks can be dropped from the front in O(1) */
+    QList<Block>        m_blocks;
+
+    /** The wrap width, and a counter bumped every time it changes */
+    int                 m_width;
+    int                 m_widthGen;
+
+    /** The number of canonical lines */
+    int                 m_numLines;
+
+    /** The number of lines of each nonzero length. This lets numRows() be
+     *  recomputed for a new width by only visiting lengths that wrap.
+     */
+    QMap<int, int>      m_lengthCounts;
+
+    /** The cached result of numRows(), valid when m_totalValid is true */
+    mutable int         m_totalRows;
+    mutable bool        m_totalValid;
+
+    /** The first m_frontValid blocks (the front region) have a valid prefix
+     *  field, and the last m_backValid blocks (the back region) have a valid
+     *  suffix field. Queries that land outside both regions grow whichever
+     *  region is closer until it covers the query.
+     */
+    mutable int         m_frontValid;
+    mutable int         m_backValid;
+
+    /** Returns the row count of the given block, recomputing it if the width
+     *  has changed since it was last cached
+     */
+    int blockRows(int block) const;
+
+    /** Returns the number of rows before the given block */
+    int blockStart(int block) const;
+
+    /** Grows the front or back region by one block */
+    void extendFront() const;
+    void extendBack() const;
+
+    /** Invalidates cached sums after the row count of a block changes */
+    void blockChanged(int block, int delta);
+
+    /** Updates m_lengthCounts for a line changing from one length to another.
+     *  Pass -1 for oldLength when adding a new line.
+     */
+    void countLength(int oldLength, int newLength);
+};
+
+#endif // LINEINDEX_H
@@ -4,26 +4,60 @@ TEMPLATE  = app
 
 QT       += core gui widgets
 
-HEADERS  += cursor.h \
+HEADERS  += bytering.h \
+            cell.h \
+            cursor.h \
+            escapehandler.h \
+            frame.h \
             history.h \
+            inputqueue.h \
+            latencytrace.h \
+            lineindex.h \
             mainwindow.h \
             processshell.h \
+            recording.h \
             renderdata.h \
+            replayshell.h \
+            screen.h \
+            scrollback.h \
+            session.h \
             shell.h \
             specialchars.h \
+            styletable.h \
             terminalwidget.h \
             theme.h
 
-SOURCES  += cursor.cpp \
+SOURCES  += bytering.cpp \
+            cursor.cpp \
             main.cpp \
             history.cpp \
+            inputqueue.cpp \
+            latencytrace.cpp \
+            lineindex.cpp \
             renderdata.cpp \
             mainwindow.cpp \
             processshell.cpp \
+            recording.cpp \
+            replayshell.cpp \
+            screen.cpp \
+            scrollback.cpp \
+            session.cpp \
             shell.cpp \
             specialchars.cpp \
+            styletable.cpp \
             terminalwidget.cpp \
             theme.cpp
 
 FORMS    += mainwindow.ui
 
+# The pseudo-terminal shell driver
+linux {
+    HEADERS += ptyshell.h
+    SOURCES += ptyshell.cpp
+    LIBS    += -lutil
+}
+
+# "make bench" builds and runs the throughput benchmarks in bench/
+bench.commands = $(MKDIR) bench && cd bench && $(QMAKE) $$PWD/bench/bench.pro && $(MAKE) && ./bench
+QMAKE_EXTRA_TARGETS += bench
+
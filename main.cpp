@@ -1,11 +1,23 @@
 #include <QApplication>
+#include "latencytrace.h"
 #include "mainwindow.h"
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    // LWT_LATENCY=<file> traces keypress-to-pixel latency, and writes the
+    // histograms to <file> on Ctrl+Shift+F12 and on exit
+    QByteArray trace = qgetenv("LWT_LATENCY");
+
+    if (!trace.isEmpty())
+        LatencyTrace::start(QString::fromLocal8Bit(trace));
+
     MainWindow w;
     w.show();
     
-    return a.exec();
+    int ret = a.exec();
+
+    LatencyTrace::dump();
+    return ret;
 }
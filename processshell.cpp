@@ -1,8 +1,13 @@
 #include "processshell.h"
 
+#include "latencytrace.h"
+
+#include <QMetaObject>
+
 ProcessShell::ProcessShell(const QString &command, const QStringList &args)
     : m_command(command),
-      m_args(args)
+      m_args(args),
+      m_process(this)
 { }
 
 ProcessShell::~ProcessShell()
@@ -27,6 +32,7 @@ void ProcessShell::open()
         close();
 
     connect(&m_process, SIGNAL(readyReadStandardOutput()), SLOT(onstdout()));
+    connect(&m_process, SIGNAL(bytesWritten(qint64)), SLOT(onstdin()));
     connect(&m_process, SIGNAL(finished(int,QProcess::ExitStatus)),
             SLOT(onclose()));
 
@@ -45,27 +51,70 @@ bool ProcessShell::isOpen()
     return m_process.isOpen();
 }
 
-QString ProcessShell::write(const QString &str)
+void ProcessShell::inputQueued()
 {
-    QByteArray ba = str.toUtf8();
-
-    size_t nw = m_process.write(ba);
-    ba.remove(0, nw);
-
-    return QString(ba);
+    // write() may be called from any thread, but m_process belongs to ours
+    QMetaObject::invokeMethod(this, "onstdin", Qt::QueuedConnection);
 }
 
 void ProcessShell::onstdout()
 {
+    // Read straight into the output buffer. Whatever doesn't fit stays in
+    // QProcess's own buffer until the receiver makes room
     while (m_process.bytesAvailable() > 0)
     {
-        QByteArray bytes = m_process.read(m_process.bytesAvailable());
-        emit read(bytes);
+        int n;
+        char *buf = outputBuffer(&n);
+
+        if (n == 0)
+        {
+            if (waitForOutputSpace())
+                return;
+
+            continue;
+        }
+
+        qint64 nread = m_process.read(buf, n);
+        if (nread <= 0)
+            break;
+
+        commitOutput(nread);
+    }
+}
+
+void ProcessShell::resumeOutput()
+{
+    // We're inside the receiver's consume() call; pick up where we left off
+    // once it's done
+    QMetaObject::invokeMethod(this, "onstdout", Qt::QueuedConnection);
+}
+
+void ProcessShell::onstdin()
+{
+    // QProcess buffers whatever it's given, so only hand it a little at a
+    // time, and the rest as the process reads it. That keeps the input queue
+    // in charge of what gets written next
+    if (!m_process.isOpen())
+        return;
+
+    while (m_process.bytesToWrite() < WRITE_AHEAD)
+    {
+        int n;
+        const char *data = input().peek(&n);
+
+        if (n == 0)
+            break;
+
+        m_process.write(data, n);
+        input().consume(n);
+
+        LatencyTrace::mark(LatencyTrace::InputWritten);
     }
 }
 
 void ProcessShell::onclose()
 {
+    input().clear();
     emit closed();
 }
 
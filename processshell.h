@@ -16,6 +16,10 @@
  *  This driver is hence a fallback for when we don't have a platform-specific
  *  driver. It's guaranteed to work on just about any OS, but it forces the
  *  user to run all programs in non-interactive mode.
+ *
+ *  QProcess keeps reading the shell's output into a buffer of its own, so
+ *  this driver can't hold the shell up when the output buffer is full; it
+ *  just stops moving data out of QProcess until there's room.
  */
 class ProcessShell : public Shell
 {
@@ -35,15 +39,26 @@ public:
     void open();
     void close();
     bool isOpen();
-    QString write(const QString &str);
+
+protected:
+    void inputQueued();
+    void resumeOutput();
 
 private slots:
+    void onstdin();
     void onstdout();
     void onclose();
 
 private:
+    /** The most input handed to QProcess before it has written it to the
+     *  process
+     */
+    static const int WRITE_AHEAD = 4096;
+
     QString m_command;
     QStringList m_args;
+
+    /** Parented to this shell, so it follows it to another thread */
     QProcess m_process;
 };
 
@@ -0,0 +1,399 @@
+#include "ptyshell.h"
+
+#include "latencytrace.h"
+
+#include <QFile>
+#include <QList>
+#include <QMutexLocker>
+#include <QStandardPaths>
+#include <QThread>
+#include <QVector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+const char *PtyShell::TERM = "xterm-256color";
+
+/** The thread that reads a PtyShell's output and writes its input */
+class PtyThread : public QThread
+{
+public:
+    PtyThread(PtyShell *shell) : m_shell(shell) { }
+
+protected:
+    void run();
+
+private:
+    PtyShell *m_shell;
+
+    /** Writes queued input to the terminal until it's all written or the
+     *  terminal can't take any more for now
+     */
+    void writeInput();
+};
+
+void PtyThread::run()
+{
+    pollfd fds[2];
+    fds[1].fd = m_shell->m_wake[0];
+    fds[1].events = POLLIN;
+
+    bool eof = false;
+
+    while (!eof)
+    {
+        // Stop watching the terminal while the output buffer is full. The
+        // shell then blocks once the terminal's own buffer fills up, until
+        // the receiver makes room and resumeOutput() wakes us up. Input
+        // waits too, but not for long: the receiver is busy making room
+        int space;
+        m_shell->outputBuffer(&space);
+
+        bool full = (space == 0 && m_shell->waitForOutputSpace());
+
+        fds[0].fd = full ? -1 : m_shell->m_master;
+        fds[0].events = POLLIN;
+
+        if (!m_shell->input().isEmpty())
+            fds[0].events |= POLLOUT;
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        if (fds[1].revents)
+        {
+            char buf[64];
+            while (::read(m_shell->m_wake[0], buf, sizeof(buf)) > 0)
+                ;
+
+            if (m_shell->m_stopping.loadAcquire())
+                return;
+        }
+
+        if (fds[0].fd < 0 || !fds[0].revents)
+            continue;
+
+        if (fds[0].revents & POLLOUT)
+            writeInput();
+
+        // Read everything the shell has written so far, straight into the
+        // output buffer. The master is non-blocking, so this stops as soon
+        // as there's nothing left. The receiver is woken up by the first
+        // commit and picks up the rest along with it
+        for (;;)
+        {
+            int n;
+            char *buf = m_shell->outputBuffer(&n);
+
+            if (n == 0)
+                break;
+
+            ssize_t nread = ::read(m_shell->m_master, buf, n);
+
+            if (nread > 0)
+            {
+                m_shell->commitOutput(nread);
+                continue;
+            }
+
+            if (nread < 0 && errno == EINTR)
+                continue;
+
+            // Anything but "try again later" (typically EIO) means every
+            // process on the other side has closed the terminal
+            if (nread == 0 || errno != EAGAIN)
+                eof = true;
+
+            break;
+        }
+    }
+
+    m_shell->m_exited.fetchAndStoreOrdered(1);
+    emit m_shell->closed();
+}
+
+void PtyThread::writeInput()
+{
+    InputQueue &input = m_shell->input();
+
+    for (;;)
+    {
+        int n;
+        const char *data = input.peek(&n);
+
+        if (n == 0)
+            return;
+
+        ssize_t written = ::write(m_shell->m_master, data, n);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Nobody is left to read it
+            if (errno != EAGAIN)
+                input.clear();
+
+            return;
+        }
+
+        input.consume(written);
+        LatencyTrace::mark(LatencyTrace::InputWritten);
+    }
+}
+
+PtyShell::PtyShell(const QString &command, const QStringList &args)
+    : m_command(command),
+      m_args(args),
+      m_pid(-1),
+      m_master(-1),
+      m_thread(0),
+      m_exited(0),
+      m_stopping(0),
+      m_rows(24),
+      m_cols(80)
+{
+    m_wake[0] = m_wake[1] = -1;
+}
+
+PtyShell::~PtyShell()
+{
+    close();
+}
+
+const QString &PtyShell::command() const
+{
+    return m_command;
+}
+
+const QStringList &PtyShell::args() const
+{
+    return m_args;
+}
+
+void PtyShell::open()
+{
+    if (m_master >= 0)
+        close();
+
+    // Build everything the child needs up front: the process is
+    // multithreaded, so between fork() and exec() the child mustn't allocate
+    // or touch the environment, since another thread may have held the lock
+    // for either at the time of the fork
+    QString program = QStandardPaths::findExecutable(m_command);
+
+    if (program.isEmpty())
+    {
+        qWarning("PtyShell: could not find %s", qPrintable(m_command));
+        emit closed();
+        return;
+    }
+
+    QByteArray path = QFile::encodeName(program);
+
+    QList<QByteArray> args;
+    args.append(QFile::encodeName(m_command));
+
+    foreach (const QString &arg, m_args)
+        args.append(arg.toLocal8Bit());
+
+    // Our environment, with TERM replaced
+    QList<QByteArray> env;
+
+    for (char **var = environ; *var; ++var)
+    {
+        if (strncmp(*var, "TERM=", 5) != 0)
+            env.append(QByteArray(*var));
+    }
+
+    QByteArray term("TERM=");
+    term.append(TERM);
+    env.append(term);
+
+    QVector<char*> argv, envp;
+
+    for (int i = 0; i < args.size(); ++i)
+        argv.append(args[i].data());
+
+    for (int i = 0; i < env.size(); ++i)
+        envp.append(env[i].data());
+
+    argv.append(0);
+    envp.append(0);
+
+    winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_row = m_rows;
+    ws.ws_col = m_cols;
+
+    int wakePipe[2];
+
+    if (pipe(wakePipe) < 0)
+    {
+        qWarning("PtyShell: could not create a pipe: %s", strerror(errno));
+        emit closed();
+        return;
+    }
+
+    int master;
+    pid_t pid = forkpty(&master, 0, 0, &ws);
+
+    if (pid < 0)
+    {
+        qWarning("PtyShell: could not create a terminal: %s", strerror(errno));
+
+        ::close(wakePipe[0]);
+        ::close(wakePipe[1]);
+
+        emit closed();
+        return;
+    }
+
+    if (pid == 0)
+    {
+        // The child: forkpty() has already made the terminal its stdin,
+        // stdout and stderr
+        ::close(wakePipe[0]);
+        ::close(wakePipe[1]);
+
+        execve(path.constData(), argv.data(), envp.data());
+
+        _exit(127);
+    }
+
+    m_pid = pid;
+    m_master = master;
+    m_exited.fetchAndStoreOrdered(0);
+    m_stopping.fetchAndStoreOrdered(0);
+
+    // Keep the descriptors out of anything else this process starts
+    fcntl(m_master, F_SETFD, FD_CLOEXEC);
+    fcntl(wakePipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(wakePipe[1], F_SETFD, FD_CLOEXEC);
+
+    fcntl(m_master, F_SETFL, fcntl(m_master, F_GETFL) | O_NONBLOCK);
+    fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL) | O_NONBLOCK);
+
+    {
+        QMutexLocker lock(&m_wakeLock);
+        m_wake[0] = wakePipe[0];
+        m_wake[1] = wakePipe[1];
+    }
+
+    m_thread = new PtyThread(this);
+    m_thread->start();
+}
+
+void PtyShell::close()
+{
+    if (m_master < 0)
+        return;
+
+    // Hang up, the way closing any other terminal window does
+    kill(m_pid, SIGHUP);
+
+    m_stopping.fetchAndStoreOrdered(1);
+    wake();
+
+    m_thread->wait();
+    delete m_thread;
+    m_thread = 0;
+
+    // Input can still be queued from other threads; once the write end is
+    // gone, wake() ignores it rather than writing to a closed descriptor,
+    // or one that has since been reused
+    {
+        QMutexLocker lock(&m_wakeLock);
+        ::close(m_wake[0]);
+        ::close(m_wake[1]);
+        m_wake[0] = m_wake[1] = -1;
+    }
+
+    ::close(m_master);
+    m_master = -1;
+
+    reap();
+}
+
+bool PtyShell::isOpen()
+{
+    return m_master >= 0 && !m_exited.loadAcquire();
+}
+
+void PtyShell::resizeTerminal(int rows, int cols)
+{
+    m_rows = rows;
+    m_cols = cols;
+
+    if (m_master < 0)
+        return;
+
+    // The kernel sends the shell's foreground process group a SIGWINCH
+    winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_row = rows;
+    ws.ws_col = cols;
+
+    ioctl(m_master, TIOCSWINSZ, &ws);
+}
+
+void PtyShell::inputQueued()
+{
+    wake();
+}
+
+void PtyShell::resumeOutput()
+{
+    wake();
+}
+
+void PtyShell::wake()
+{
+    QMutexLocker lock(&m_wakeLock);
+
+    if (m_wake[1] < 0)
+        return;
+
+    // If the pipe is full, the reader has plenty of wakeups waiting already
+    char c = 0;
+    while (::write(m_wake[1], &c, 1) < 0 && errno == EINTR)
+        ;
+}
+
+void PtyShell::reap()
+{
+    for (int waited = 0; waited < REAP_TIMEOUT_MS; waited += REAP_POLL_MS)
+    {
+        pid_t ret = waitpid(m_pid, 0, WNOHANG);
+
+        // Either it exited, or someone else already reaped it
+        if (ret == m_pid || (ret < 0 && errno != EINTR))
+        {
+            m_pid = -1;
+            return;
+        }
+
+        usleep(REAP_POLL_MS * 1000);
+    }
+
+    kill(m_pid, SIGKILL);
+    waitpid(m_pid, 0, 0);
+
+    m_pid = -1;
+}
@@ -0,0 +1,107 @@
+#ifndef PTYSHELL_H
+#define PTYSHELL_H
+
+#include "shell.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+
+#include <sys/types.h>
+
+class PtyThread;
+
+/** A shell driver for Unix-like systems, which runs the shell on a
+ *  pseudo-terminal.
+ *
+ *  Unlike ProcessShell, the shell and everything it starts see a real
+ *  terminal (isatty() is true, and the window size is known), so interactive
+ *  programs behave the way they would in any other terminal emulator.
+ *
+ *  Output is read by a dedicated thread that sleeps in poll() on the master
+ *  side of the terminal. Whenever it wakes up, it reads everything the shell
+ *  has written so far straight into the output buffer; the receiver is woken
+ *  up at most once for all of it. While the output buffer is full the thread
+ *  stops polling the terminal, which eventually blocks the shell's writes.
+ *
+ *  The same thread writes queued input to the terminal whenever it can take
+ *  more, so neither typing nor pasting ever waits on a slow reader.
+ */
+class PtyShell : public Shell
+{
+    Q_OBJECT
+
+public:
+    PtyShell(const QString &command, const QStringList &args = QStringList());
+    virtual ~PtyShell();
+
+    /** The shell binary to run when the shell is opened */
+    const QString &command() const;
+
+    /** The list of arguments to pass to the shell binary */
+    const QStringList &args() const;
+
+    /** Abstract shell methods documented in shell.h */
+    void open();
+    void close();
+    bool isOpen();
+
+    /** The value of TERM in the shell's environment */
+    static const char *TERM;
+
+protected:
+    void resizeTerminal(int rows, int cols);
+    void inputQueued();
+    void resumeOutput();
+
+private:
+    friend class PtyThread;
+
+    /** How long close() waits for the shell to exit after hanging up on it,
+     *  and how often it checks
+     */
+    static const int REAP_TIMEOUT_MS = 200;
+    static const int REAP_POLL_MS = 10;
+
+    QString m_command;
+    QStringList m_args;
+
+    /** The shell's process id, and the master side of its terminal. The
+     *  master is -1 while the shell isn't open
+     */
+    pid_t m_pid;
+    int m_master;
+
+    /** A pipe used to wake the reader thread up: when closing the shell,
+     *  when there is room in the output buffer again, or when there is input
+     *  to write. Input and output wakeups come from other threads, so the
+     *  write end is only used or closed under m_wakeLock
+     */
+    int m_wake[2];
+    QMutex m_wakeLock;
+
+    PtyThread *m_thread;
+
+    /** Set by the reader thread when the shell closes its terminal */
+    QAtomicInt m_exited;
+
+    /** Set by close() before waking the reader up, to make it exit */
+    QAtomicInt m_stopping;
+
+    /** The window size, remembered so it can be set before the shell starts */
+    int m_rows;
+    int m_cols;
+
+    /** Wakes the reader thread up, if the shell is open. Safe to call from
+     *  any thread
+     */
+    void wake();
+
+    /** Waits briefly for the shell to exit after it was hung up on, killing
+     *  it if it doesn't
+     */
+    void reap();
+};
+
+#endif // PTYSHELL_H
@@ -0,0 +1,197 @@
+#include "recording.h"
+
+// "LWTREC" followed by the format version
+#define HEADER          "LWTREC\0\1"
+#define HEADER_SIZE     8
+
+Recording::Recording()
+    : m_time(0),
+      m_unread(0)
+{ }
+
+Recording::~Recording()
+{
+    close();
+}
+
+bool Recording::create(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || m_file.write(HEADER, HEADER_SIZE) != HEADER_SIZE)
+    {
+        m_file.close();
+        return false;
+    }
+
+    m_clock.start();
+    m_time = 0;
+
+    return true;
+}
+
+bool Recording::open(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    if (m_file.read(HEADER_SIZE) != QByteArray(HEADER, HEADER_SIZE))
+    {
+        m_file.close();
+        return false;
+    }
+
+    m_time = 0;
+    m_unread = 0;
+
+    return true;
+}
+
+void Recording::close()
+{
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+void Recording::writeOutput(const char *data, int n)
+{
+    beginRecord(Output);
+    appendNumber(n);
+
+    m_file.write(m_header);
+    m_file.write(data, n);
+    m_file.flush();
+}
+
+void Recording::writeResize(int rows, int cols)
+{
+    beginRecord(Resize);
+    appendNumber(rows);
+    appendNumber(cols);
+
+    m_file.write(m_header);
+    m_file.flush();
+}
+
+bool Recording::readRecord(Record *record)
+{
+    if (m_unread > 0 && !m_file.seek(m_file.pos() + m_unread))
+        return false;
+
+    m_unread = 0;
+
+    char type;
+    quint64 delta;
+
+    if (!m_file.getChar(&type) || !readNumber(&delta))
+        return false;
+
+    m_time += delta;
+
+    record->type = (Type)type;
+    record->time = m_time;
+    record->size = 0;
+    record->rows = 0;
+    record->cols = 0;
+
+    quint64 a, b;
+
+    switch (type)
+    {
+    case Output:
+        if (!readNumber(&a) || a > MAX_OUTPUT)
+            return false;
+
+        record->size = m_unread = a;
+        return true;
+
+    case Resize:
+        if (!readNumber(&a) || !readNumber(&b)
+            || a > MAX_VIEWPORT || b > MAX_VIEWPORT)
+        {
+            return false;
+        }
+
+        record->rows = a;
+        record->cols = b;
+        return true;
+
+    default:
+        // A newer version of the format; nothing past this can be trusted
+        return false;
+    }
+}
+
+int Recording::readOutput(char *buf, int n)
+{
+    if (n > m_unread)
+        n = m_unread;
+
+    if (n <= 0)
+        return 0;
+
+    qint64 nread = m_file.read(buf, n);
+
+    if (nread <= 0)
+    {
+        // Cut off, e.g. because lwt didn't get to exit cleanly
+        m_unread = 0;
+        return 0;
+    }
+
+    m_unread -= nread;
+    return nread;
+}
+
+void Recording::beginRecord(Type type)
+{
+    qint64 now = m_clock.nsecsElapsed() / 1000;
+
+    m_header.clear();
+    m_header.append((char)type);
+    appendNumber(now - m_time);
+
+    m_time = now;
+}
+
+void Recording::appendNumber(quint64 value)
+{
+    // Seven bits at a time, low bits first; the top bit says more follow
+    do
+    {
+        char byte = value & 0x7F;
+        value >>= 7;
+
+        if (value)
+            byte |= 0x80;
+
+        m_header.append(byte);
+    }
+    while (value);
+}
+
+bool Recording::readNumber(quint64 *value)
+{
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        char byte;
+        if (!m_file.getChar(&byte))
+            return false;
+
+        *value |= quint64(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
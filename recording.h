@@ -0,0 +1,102 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+/** A file of raw shell output, with the time each chunk arrived and the
+ *  viewport size at the time, so a slow session can be played back later
+ *  without the program that produced it (see ReplayShell).
+ *
+ *  The format is compact and binary. After an eight-byte header ("LWTREC"
+ *  and a two-byte version), each record is a type byte, the microseconds
+ *  since the previous record, then:
+ *
+ *   - Output: the number of bytes, followed by the bytes themselves
+ *   - Resize: the number of rows and columns
+ *
+ *  All numbers are unsigned LEB128 varints, so a typical record header is
+ *  three to five bytes.
+ */
+class Recording
+{
+public:
+    enum Type
+    {
+        Output = 1,
+        Resize = 2
+    };
+
+    /** The header of one record. Output data is read separately, with
+     *  readOutput()
+     */
+    struct Record
+    {
+        Type type;
+        qint64 time;    // Microseconds since the recording started
+        int size;       // Output bytes
+        int rows;       // Viewport size
+        int cols;
+    };
+
+    Recording();
+    ~Recording();
+
+    /** Creates the given file and starts a new recording in it. Returns
+     *  false if it couldn't be created
+     */
+    bool create(const QString &path);
+
+    /** Opens the given recording for reading. Returns false if it doesn't
+     *  exist or isn't a recording
+     */
+    bool open(const QString &path);
+
+    /** Flushes and closes the file */
+    void close();
+
+    /** Appends a record, timestamped now. Each record goes to the file as
+     *  it's written, so a crash loses nothing but the record being written
+     */
+    void writeOutput(const char *data, int n);
+    void writeResize(int rows, int cols);
+
+    /** Reads the next record's header, skipping any output the previous one
+     *  had left. Returns false at the end of the recording, or if the rest
+     *  of it is damaged
+     */
+    bool readRecord(Record *record);
+
+    /** Reads up to n bytes of the current output record into buf. Returns
+     *  the number of bytes read, which is zero once the record is used up
+     */
+    int readOutput(char *buf, int n);
+
+private:
+    /** Sanity limits, so a damaged file can't ask for a huge read */
+    static const int MAX_OUTPUT = 64 * 1024 * 1024;
+    static const int MAX_VIEWPORT = 65535;
+
+    QFile m_file;
+
+    /** When writing, the time since the recording was created, and the
+     *  time of the last record. When reading, the latter is the running
+     *  total of the time deltas
+     */
+    QElapsedTimer m_clock;
+    qint64 m_time;
+
+    /** Output bytes of the current record that haven't been read yet */
+    int m_unread;
+
+    /** Record headers are put together here, then written in one go */
+    QByteArray m_header;
+
+    void beginRecord(Type type);
+    void appendNumber(quint64 value);
+    bool readNumber(quint64 *value);
+};
+
+#endif // RECORDING_H
@@ -1,6 +1,8 @@
 #ifndef RENDERDATA_H
 #define RENDERDATA_H
 
+#include "styletable.h"
+
 #include <QString>
 #include <QVector>
 
@@ -33,15 +35,14 @@ public:
     /** A section of a line.
      *
      *  Each line has one or more sections. A single line is split into
-     *  multiple sections when the colors change
+     *  multiple sections when the style changes
      */
     struct Section
     {
         int     line;       // The row index of the line this sections occurs
         QString data;       // The textual contents of this section
 
-        int     foreground; // Color palette index of the foreground color
-        int     background; // Color palette index of the background color
+        Style   style;      // The colors and attributes of this section
     };
 
     RenderData(const QVector<Section> &sections);
@@ -0,0 +1,190 @@
+#include "replayshell.h"
+
+#include "recording.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QThread>
+
+/** The thread that feeds a ReplayShell's recording into its output buffer */
+class ReplayThread : public QThread
+{
+public:
+    ReplayThread(ReplayShell *shell) : m_shell(shell) { }
+
+protected:
+    void run();
+
+private:
+    ReplayShell *m_shell;
+
+    /** Moves the current output record into the output buffer, adding the
+     *  number of bytes to *total. Returns false if the shell is closing
+     */
+    bool replayOutput(Recording *recording, qint64 *total);
+};
+
+void ReplayThread::run()
+{
+    Recording recording;
+
+    if (!recording.open(m_shell->m_path))
+    {
+        qWarning("ReplayShell: could not open recording %s",
+                 qPrintable(m_shell->m_path));
+    }
+    else
+    {
+        QElapsedTimer clock;
+        clock.start();
+
+        Recording::Record record;
+        qint64 total = 0;
+
+        while (recording.readRecord(&record))
+        {
+            if (record.type == Recording::Resize)
+            {
+                m_shell->requestViewport(record.rows, record.cols);
+                continue;
+            }
+
+            // Wait until the output is due. If the receiver has fallen
+            // behind, carry on straight away rather than drifting further
+            qint64 due;
+
+            while (m_shell->m_realTime
+                   && (due = record.time / 1000 - clock.elapsed()) > 0)
+            {
+                if (!m_shell->sleep(int(due)))
+                    return;
+            }
+
+            if (!replayOutput(&recording, &total))
+                return;
+        }
+
+        // The time that counts is until everything has been parsed
+        while (!m_shell->outputDrained())
+        {
+            if (!m_shell->sleep(ReplayShell::DRAIN_POLL_MS))
+                return;
+        }
+
+        qint64 msecs = clock.elapsed();
+
+        qDebug("ReplayShell: replayed %lld bytes in %lld ms (%.1f MB/s)",
+               (long long)total, (long long)msecs,
+               total / (1024.0 * 1024.0) / (qMax(msecs, qint64(1)) / 1000.0));
+    }
+
+    m_shell->m_finished.fetchAndStoreOrdered(1);
+}
+
+bool ReplayThread::replayOutput(Recording *recording, qint64 *total)
+{
+    for (;;)
+    {
+        int n;
+        char *buf = m_shell->outputBuffer(&n);
+
+        if (n == 0)
+        {
+            if (m_shell->waitForOutputSpace() && !m_shell->sleep(-1))
+                return false;
+
+            continue;
+        }
+
+        n = recording->readOutput(buf, n);
+
+        if (n == 0)
+            return true;
+
+        m_shell->commitOutput(n);
+        *total += n;
+    }
+}
+
+ReplayShell::ReplayShell(const QString &path, bool realTime)
+    : m_path(path),
+      m_realTime(realTime),
+      m_thread(0),
+      m_finished(0),
+      m_woken(false),
+      m_stopping(false)
+{ }
+
+ReplayShell::~ReplayShell()
+{
+    close();
+}
+
+const QString &ReplayShell::path() const
+{
+    return m_path;
+}
+
+void ReplayShell::open()
+{
+    if (m_thread)
+        close();
+
+    m_finished.fetchAndStoreOrdered(0);
+    m_woken = false;
+    m_stopping = false;
+
+    m_thread = new ReplayThread(this);
+    m_thread->start();
+}
+
+void ReplayShell::close()
+{
+    if (!m_thread)
+        return;
+
+    {
+        QMutexLocker lock(&m_lock);
+        m_stopping = true;
+        m_wakeup.wakeAll();
+    }
+
+    m_thread->wait();
+    delete m_thread;
+    m_thread = 0;
+}
+
+bool ReplayShell::isOpen()
+{
+    return m_thread && !m_finished.loadAcquire();
+}
+
+void ReplayShell::inputQueued()
+{
+    // Nothing would ever read it
+    input().clear();
+}
+
+void ReplayShell::resumeOutput()
+{
+    QMutexLocker lock(&m_lock);
+    m_woken = true;
+    m_wakeup.wakeAll();
+}
+
+bool ReplayShell::sleep(int msecs)
+{
+    QMutexLocker lock(&m_lock);
+
+    // A wakeup that came in before we got here still counts
+    if (!m_woken && !m_stopping)
+    {
+        if (msecs < 0)
+            m_wakeup.wait(&m_lock);
+        else
+            m_wakeup.wait(&m_lock, msecs);
+    }
+
+    m_woken = false;
+    return !m_stopping;
+}
@@ -0,0 +1,85 @@
+#ifndef REPLAYSHELL_H
+#define REPLAYSHELL_H
+
+#include "shell.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QWaitCondition>
+
+class ReplayThread;
+
+/** A shell driver that plays back a Recording instead of running a shell.
+ *
+ *  The recorded output goes through the same output buffer and readyRead()
+ *  signal as a live shell's, so everything from the parser on behaves as it
+ *  did when the recording was made. That makes slow sessions reproducible,
+ *  and gives repeatable performance tests with real-world output.
+ *
+ *  Output is replayed either with its original timing, or as fast as the
+ *  receiver takes it. Input is thrown away, since the recording can't react
+ *  to it. Recorded resizes are passed on with requestViewport(), so the
+ *  output is parsed at the size it was written for, whatever the size of
+ *  the window.
+ *
+ *  Playback runs on a thread of its own. Once the receiver has consumed the
+ *  whole recording, the time the replay took is logged. The shell doesn't
+ *  raise closed() then, so the final screen stays up to be inspected;
+ *  isOpen() returns false.
+ */
+class ReplayShell : public Shell
+{
+    Q_OBJECT
+
+public:
+    /** Replays the recording at the given path. If realTime is false, output
+     *  is replayed as fast as possible
+     */
+    ReplayShell(const QString &path, bool realTime = true);
+    virtual ~ReplayShell();
+
+    /** The recording being replayed */
+    const QString &path() const;
+
+    /** Abstract shell methods documented in shell.h */
+    void open();
+    void close();
+    bool isOpen();
+
+protected:
+    void inputQueued();
+    void resumeOutput();
+
+private:
+    friend class ReplayThread;
+
+    /** How often the thread checks whether the receiver has caught up, at
+     *  the end of the recording
+     */
+    static const int DRAIN_POLL_MS = 1;
+
+    QString m_path;
+    bool m_realTime;
+
+    ReplayThread *m_thread;
+
+    /** Set by the thread when the recording ends */
+    QAtomicInt m_finished;
+
+    /** The thread sleeps on this, between chunks of output when replaying
+     *  in real time and while the output buffer is full. m_woken and
+     *  m_stopping are protected by the lock
+     */
+    QMutex m_lock;
+    QWaitCondition m_wakeup;
+    bool m_woken;
+    bool m_stopping;
+
+    /** Sleeps until woken, or until the given number of milliseconds have
+     *  passed if it isn't negative. Returns false if the shell is closing
+     */
+    bool sleep(int msecs);
+};
+
+#endif // REPLAYSHELL_H
@@ -0,0 +1,361 @@
+#include "screen.h"
+
+#include <algorithm>
+#include <cstring>
+
+Screen::Screen()
+    : m_rows(0),
+      m_cols(0),
+      m_cursorRow(0),
+      m_cursorCol(0),
+      m_wrapPending(false),
+      m_top(0),
+      m_bottom(0)
+{ }
+
+Screen::~Screen() { }
+
+int Screen::rows() const
+{
+    return m_rows;
+}
+
+int Screen::cols() const
+{
+    return m_cols;
+}
+
+void Screen::resize(int rows, int cols)
+{
+    rows = qMax(rows, 0);
+    cols = qMax(cols, 0);
+
+    if (rows == m_rows && cols == m_cols)
+        return;
+
+    // Lay the cells out in row order again while we're copying them anyway
+    QVector<Cell> cells(rows * cols);
+    QVector<int> rowMap(rows);
+
+    int copyRows = qMin(rows, m_rows),
+        copyCols = qMin(cols, m_cols);
+
+    for (int r = 0; r < copyRows; ++r)
+    {
+        memcpy(cells.data() + r * cols,
+               m_cells.constData() + m_rowMap[r] * m_cols,
+               copyCols * sizeof(Cell));
+    }
+
+    for (int r = 0; r < rows; ++r)
+        rowMap[r] = r;
+
+    m_cells = cells;
+    m_rowMap = rowMap;
+    m_rows = rows;
+    m_cols = cols;
+
+    m_top = 0;
+    m_bottom = rows;
+
+    m_damage.all = true;
+
+    setCursor(m_cursorRow, m_cursorCol);
+}
+
+const Cell *Screen::row(int row) const
+{
+    Q_ASSERT(row >= 0 && row < m_rows);
+
+    return m_cells.constData() + m_rowMap[row] * m_cols;
+}
+
+Cell Screen::cell(int row, int col) const
+{
+    if (row < 0 || row >= m_rows || col < 0 || col >= m_cols)
+        return Cell();
+
+    return m_cells[m_rowMap[row] * m_cols + col];
+}
+
+int Screen::cursorRow() const
+{
+    return m_cursorRow;
+}
+
+int Screen::cursorCol() const
+{
+    return m_cursorCol;
+}
+
+void Screen::setCursor(int row, int col)
+{
+    m_cursorRow = qBound(0, row, qMax(m_rows - 1, 0));
+    m_cursorCol = qBound(0, col, qMax(m_cols - 1, 0));
+    m_wrapPending = false;
+}
+
+void Screen::write(const Cell &cell)
+{
+    if (m_rows == 0 || m_cols == 0)
+        return;
+
+    if (m_wrapPending)
+        newline();
+
+    *at(m_cursorRow, m_cursorCol) = cell;
+    damageRows(m_cursorRow, m_cursorRow);
+
+    if (m_cursorCol + 1 < m_cols)
+        ++m_cursorCol;
+    else
+        m_wrapPending = true;
+}
+
+void Screen::write(const QChar *text, int n, ushort style)
+{
+    if (m_rows == 0 || m_cols == 0)
+        return;
+
+    while (n > 0)
+    {
+        if (m_wrapPending)
+            newline();
+
+        int count = qMin(n, m_cols - m_cursorCol);
+
+        Cell *cells = at(m_cursorRow, m_cursorCol);
+        for (int i = 0; i < count; ++i)
+        {
+            cells[i].ch = text[i].unicode();
+            cells[i].style = style;
+        }
+
+        damageRows(m_cursorRow, m_cursorRow);
+
+        // Stop in the last column, like write(const Cell &) does
+        m_cursorCol += count;
+        if (m_cursorCol == m_cols)
+        {
+            m_cursorCol = m_cols - 1;
+            m_wrapPending = true;
+        }
+
+        text += count;
+        n -= count;
+    }
+}
+
+void Screen::newline()
+{
+    m_wrapPending = false;
+    m_cursorCol = 0;
+
+    // Scroll if the cursor is on the bottom margin. Below the scroll region,
+    // the cursor just stops at the bottom of the screen
+    if (m_cursorRow == m_bottom - 1)
+        scrollUp(1, Cell());
+    else if (m_cursorRow + 1 < m_rows)
+        ++m_cursorRow;
+}
+
+void Screen::clear(const Cell &fill)
+{
+    m_cells.fill(fill);
+    m_damage.all = true;
+}
+
+void Screen::fill(int row, int col, int end, const Cell &fill)
+{
+    if (row < 0 || row >= m_rows)
+        return;
+
+    col = qMax(col, 0);
+    end = qMin(end, m_cols);
+
+    Cell *cells = at(row, 0);
+    for (int i = col; i < end; ++i)
+        cells[i] = fill;
+
+    damageRows(row, row);
+}
+
+void Screen::insert(int n, const Cell &fill)
+{
+    if (m_rows == 0 || m_cols == 0)
+        return;
+
+    n = qMin(n, m_cols - m_cursorCol);
+
+    Cell *cells = at(m_cursorRow, 0);
+    memmove(cells + m_cursorCol + n,
+            cells + m_cursorCol,
+            (m_cols - m_cursorCol - n) * sizeof(Cell));
+
+    for (int i = 0; i < n; ++i)
+        cells[m_cursorCol + i] = fill;
+
+    damageRows(m_cursorRow, m_cursorRow);
+    m_wrapPending = false;
+}
+
+void Screen::del(int n, const Cell &fill)
+{
+    if (m_rows == 0 || m_cols == 0)
+        return;
+
+    n = qMin(n, m_cols - m_cursorCol);
+
+    Cell *cells = at(m_cursorRow, 0);
+    memmove(cells + m_cursorCol,
+            cells + m_cursorCol + n,
+            (m_cols - m_cursorCol - n) * sizeof(Cell));
+
+    for (int i = m_cols - n; i < m_cols; ++i)
+        cells[i] = fill;
+
+    damageRows(m_cursorRow, m_cursorRow);
+    m_wrapPending = false;
+}
+
+int Screen::scrollTop() const
+{
+    return m_top;
+}
+
+int Screen::scrollBottom() const
+{
+    return m_bottom;
+}
+
+void Screen::setScrollRegion(int top, int bottom)
+{
+    if (top < 0 || bottom > m_rows || top + 1 >= bottom)
+    {
+        top = 0;
+        bottom = m_rows;
+    }
+
+    m_top = top;
+    m_bottom = bottom;
+
+    setCursor(0, 0);
+}
+
+void Screen::scrollUp(int n, const Cell &fill)
+{
+    n = qMin(n, m_bottom - m_top);
+    if (n <= 0)
+        return;
+
+    int *map = m_rowMap.data();
+    std::rotate(map + m_top, map + m_top + n, map + m_bottom);
+
+    for (int r = m_bottom - n; r < m_bottom; ++r)
+    {
+        Cell *cells = at(r, 0);
+        for (int i = 0; i < m_cols; ++i)
+            cells[i] = fill;
+    }
+
+    damageScroll(n);
+}
+
+void Screen::scrollDown(int n, const Cell &fill)
+{
+    n = qMin(n, m_bottom - m_top);
+    if (n <= 0)
+        return;
+
+    int *map = m_rowMap.data();
+    std::rotate(map + m_top, map + m_bottom - n, map + m_bottom);
+
+    for (int r = m_top; r < m_top + n; ++r)
+    {
+        Cell *cells = at(r, 0);
+        for (int i = 0; i < m_cols; ++i)
+            cells[i] = fill;
+    }
+
+    damageScroll(-n);
+}
+
+Screen::Damage Screen::takeDamage()
+{
+    Damage ret = m_damage;
+    m_damage = Damage();
+
+    return ret;
+}
+
+Cell *Screen::at(int row, int col)
+{
+    return m_cells.data() + m_rowMap[row] * m_cols + col;
+}
+
+void Screen::damageRows(int first, int last)
+{
+    Damage &d = m_damage;
+
+    if (d.lastRow < d.firstRow)
+    {
+        d.firstRow = first;
+        d.lastRow = last;
+    }
+    else
+    {
+        d.firstRow = qMin(d.firstRow, first);
+        d.lastRow = qMax(d.lastRow, last);
+    }
+}
+
+void Screen::damageScroll(int n)
+{
+    Damage &d = m_damage;
+    if (d.all)
+        return;
+
+    // Only one pixel shift per batch is tracked. Scrolling a different region
+    // means the whole screen gets repainted instead.
+    if (d.scrolled != 0 && (d.scrollTop != m_top || d.scrollBottom != m_bottom))
+    {
+        d.all = true;
+        return;
+    }
+
+    // Rows already marked for repainting move along with the region. If they
+    // straddle its edge, just repaint the whole region.
+    if (d.lastRow >= d.firstRow && d.firstRow < m_bottom && d.lastRow >= m_top)
+    {
+        if (d.firstRow >= m_top && d.lastRow < m_bottom)
+        {
+            d.firstRow = qBound(m_top, d.firstRow - n, m_bottom - 1);
+            d.lastRow = qBound(m_top, d.lastRow - n, m_bottom - 1);
+        }
+        else
+        {
+            damageRows(m_top, m_bottom - 1);
+        }
+    }
+
+    d.scrollTop = m_top;
+    d.scrollBottom = m_bottom;
+    d.scrolled += n;
+
+    int height = m_bottom - m_top;
+
+    if (qAbs(d.scrolled) >= height)
+    {
+        // Nothing on screen survives the shift
+        d.scrolled = 0;
+        damageRows(m_top, m_bottom - 1);
+    }
+    else if (n > 0)
+    {
+        damageRows(m_bottom - n, m_bottom - 1);
+    }
+    else
+    {
+        damageRows(m_top, m_top - n - 1);
+    }
+}
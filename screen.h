@@ -0,0 +1,173 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "cell.h"
+
+#include <QChar>
+#include <QVector>
+
+/** A fixed grid of cells, used as the alternate screen by full-screen
+ *  programs (vim, less, htop, ...).
+ *
+ *  Unlike the scrollback, the grid never wraps or reflows: every row is
+ *  exactly cols() cells wide, text written past the right edge continues on
+ *  the next row, and anything scrolled off the top is discarded. Writing a
+ *  cell is a single array store.
+ *
+ *  Rows are reached through a table of row indices, so scrolling (whether
+ *  from a newline at the bottom margin or from SU/SD) rotates a few integers
+ *  in that table and blanks the rows that scrolled in, rather than copying
+ *  every cell in the scroll region.
+ *
+ *  The screen also keeps track of what changed since the last call to
+ *  takeDamage(), so views can shift pixels for scrolls and only repaint the
+ *  rows that were actually modified.
+ */
+class Screen
+{
+public:
+    /** A summary of what changed on the screen */
+    struct Damage
+    {
+        Damage()
+            : all(false), scrollTop(0), scrollBottom(0), scrolled(0),
+              firstRow(0), lastRow(-1)
+        { }
+
+        /** If true, everything changed and the fields below are meaningless */
+        bool all;
+
+        /** The rows [scrollTop, scrollBottom) were scrolled up by scrolled
+         *  rows (down if scrolled is negative)
+         */
+        int scrollTop;
+        int scrollBottom;
+        int scrolled;
+
+        /** The rows [firstRow, lastRow] must be repainted after applying the
+         *  scroll. Empty if lastRow < firstRow
+         */
+        int firstRow;
+        int lastRow;
+    };
+
+    Screen();
+    ~Screen();
+
+    /** Returns the size of the grid */
+    int rows() const;
+    int cols() const;
+
+    /** Changes the size of the grid. Cells keep their row and column;
+     *  anything outside the new size is dropped, and new cells are blank.
+     */
+    void resize(int rows, int cols);
+
+    /** Returns the cells of the given row. There are always cols() of them */
+    const Cell *row(int row) const;
+
+    /** Returns the cell at the given position, or a blank cell if the
+     *  position is outside the grid
+     */
+    Cell cell(int row, int col) const;
+
+    /** Gets the cursor position */
+    int cursorRow() const;
+    int cursorCol() const;
+
+    /** Moves the cursor, clamping the position to the grid */
+    void setCursor(int row, int col);
+
+    /** Writes a cell at the cursor and advances the cursor. Writing into the
+     *  last column leaves the cursor there; the next write then wraps to the
+     *  start of the following row first.
+     */
+    void write(const Cell &cell);
+
+    /** Writes n cells with the given characters and style, as if each had
+     *  been passed to write(). The text is split at the right edge and
+     *  copied a row at a time.
+     */
+    void write(const QChar *text, int n, ushort style);
+
+    /** Moves the cursor to the start of the next row, scrolling the grid up
+     *  by one row if the cursor is on the last row
+     */
+    void newline();
+
+    /** Sets every cell to the given fill */
+    void clear(const Cell &fill);
+
+    /** Sets the cells from (row, col) up to but not including (row, end) to
+     *  the given fill. The range is clamped to the row.
+     */
+    void fill(int row, int col, int end, const Cell &fill);
+
+    /** Inserts n copies of fill at the cursor, pushing the rest of the row to
+     *  the right. Cells pushed past the right edge are lost.
+     */
+    void insert(int n, const Cell &fill);
+
+    /** Deletes n cells at the cursor, pulling the rest of the row to the left
+     *  and filling the right edge with the given fill
+     */
+    void del(int n, const Cell &fill);
+
+    /** Gets or sets the scroll region: the rows [top, bottom) that scroll
+     *  when the cursor moves past the bottom margin or when scrollUp() or
+     *  scrollDown() is called. Invalid regions reset it to the whole screen.
+     *  Setting the region also homes the cursor.
+     */
+    int scrollTop() const;
+    int scrollBottom() const;
+    void setScrollRegion(int top, int bottom);
+
+    /** Shifts the rows of the scroll region up by n rows, discarding the top
+     *  rows and filling the bottom rows with the given fill
+     */
+    void scrollUp(int n, const Cell &fill);
+
+    /** Shifts the rows of the scroll region down by n rows, discarding the
+     *  bottom rows and filling the top rows with the given fill
+     */
+    void scrollDown(int n, const Cell &fill);
+
+    /** Returns what changed since the last call, and resets it */
+    Damage takeDamage();
+
+private:
+    /** The cells of the grid. The cells of row r start at
+     *  m_rowMap[r] * m_cols
+     */
+    QVector<Cell>   m_cells;
+    QVector<int>    m_rowMap;
+
+    int             m_rows;
+    int             m_cols;
+
+    int             m_cursorRow;
+    int             m_cursorCol;
+
+    /** True if the last write() went into the last column, so the next one
+     *  must wrap first
+     */
+    bool            m_wrapPending;
+
+    /** See setScrollRegion() */
+    int             m_top;
+    int             m_bottom;
+
+    /** See takeDamage() */
+    Damage          m_damage;
+
+    /** Returns a pointer to the given cell */
+    Cell *at(int row, int col);
+
+    /** Records that the given rows were modified in place */
+    void damageRows(int first, int last);
+
+    /** Records that the scroll region was scrolled by n rows */
+    void damageScroll(int n);
+};
+
+#endif // SCREEN_H
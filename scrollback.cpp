@@ -0,0 +1,346 @@
+#include "scrollback.h"
+
+#include <algorithm>
+#include <cstring>
+
+Scrollback::Scrollback()
+    : m_numLines(0),
+      m_blocksRemoved(0),
+      m_spill(false),
+      m_spillFile(0)
+{ }
+
+Scrollback::~Scrollback()
+{
+    delete m_spillFile;
+}
+
+int Scrollback::numLines() const
+{
+    return m_numLines;
+}
+
+int Scrollback::length(int line) const
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    const Block &b = m_blocks[line / BLOCK_SIZE];
+    int i = line % BLOCK_SIZE;
+
+    return b.offsets[i + 1] - b.offsets[i];
+}
+
+const Cell *Scrollback::cells(int line) const
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    const Block &b = load(line / BLOCK_SIZE);
+    return b.cells.constData() + b.offsets[line % BLOCK_SIZE];
+}
+
+void Scrollback::appendLine()
+{
+    if (m_blocks.isEmpty() || m_blocks.last().offsets.size() > BLOCK_SIZE)
+    {
+        Block b;
+        b.offsets.reserve(BLOCK_SIZE + 1);
+        b.offsets.append(0);
+
+        m_blocks.append(b);
+
+        // Starting a new block pushes an older one out of the hot set
+        int cold = m_blocks.size() - 1 - HOT_BLOCKS;
+        if (cold >= 0)
+            seal(cold);
+    }
+
+    Block &b = m_blocks.last();
+    b.offsets.append(b.cells.size());
+
+    ++m_numLines;
+}
+
+void Scrollback::removeFront(int n)
+{
+    Q_ASSERT(n >= 0 && n <= m_numLines && n % BLOCK_SIZE == 0);
+
+    for (int i = 0; i < n / BLOCK_SIZE; ++i)
+        m_blocks.removeFirst();
+
+    m_numLines -= n;
+    m_blocksRemoved += n / BLOCK_SIZE;
+
+    // Forget cache entries for blocks that no longer exist
+    for (int i = m_cache.size() - 1; i >= 0; --i)
+    {
+        if (m_cache[i] < m_blocksRemoved)
+            m_cache.removeAt(i);
+    }
+}
+
+void Scrollback::setCell(int line, int col, const Cell &cell)
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    Block &b = modify(line / BLOCK_SIZE);
+    int i = line % BLOCK_SIZE,
+        beg = b.offsets[i],
+        len = b.offsets[i + 1] - beg;
+
+    Q_ASSERT(col >= 0 && col <= len);
+
+    if (col < len)
+        b.cells[beg + col] = cell;
+    else
+        insert(line, col, 1, cell);
+}
+
+void Scrollback::write(int line, int col, const QChar *text, int n,
+                       ushort style)
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    if (n <= 0)
+        return;
+
+    Block &b = modify(line / BLOCK_SIZE);
+    int i = line % BLOCK_SIZE,
+        beg = b.offsets[i],
+        len = b.offsets[i + 1] - beg;
+
+    Q_ASSERT(col >= 0 && col <= len);
+
+    // Make room for the part of the text that runs past the end of the line
+    // in one go, then fill everything in place
+    int grow = col + n - len;
+    if (grow > 0)
+    {
+        b.cells.insert(beg + len, grow, Cell());
+        shiftOffsets(b, i, grow);
+    }
+
+    Cell *cells = b.cells.data() + beg + col;
+    for (int k = 0; k < n; ++k)
+    {
+        cells[k].ch = text[k].unicode();
+        cells[k].style = style;
+    }
+}
+
+void Scrollback::insert(int line, int col, int n, const Cell &fill)
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    if (n <= 0)
+        return;
+
+    Block &b = modify(line / BLOCK_SIZE);
+    int i = line % BLOCK_SIZE;
+
+    Q_ASSERT(col >= 0 && col <= b.offsets[i + 1] - b.offsets[i]);
+
+    b.cells.insert(b.offsets[i] + col, n, fill);
+    shiftOffsets(b, i, n);
+}
+
+void Scrollback::remove(int line, int col, int n)
+{
+    Q_ASSERT(line >= 0 && line < m_numLines);
+
+    if (n <= 0)
+        return;
+
+    Block &b = modify(line / BLOCK_SIZE);
+    int i = line % BLOCK_SIZE;
+
+    Q_ASSERT(col >= 0 && col + n <= b.offsets[i + 1] - b.offsets[i]);
+
+    b.cells.remove(b.offsets[i] + col, n);
+    shiftOffsets(b, i, -n);
+}
+
+void Scrollback::truncate(int line, int col)
+{
+    int len = length(line);
+
+    if (col < len)
+        remove(line, col, len - col);
+}
+
+bool Scrollback::spillToDisk() const
+{
+    return m_spill;
+}
+
+void Scrollback::setSpillToDisk(bool spill)
+{
+    m_spill = spill;
+}
+
+void Scrollback::markStyles(QBitArray *live) const
+{
+    for (int i = 0; i < m_blocks.size(); ++i)
+    {
+        const Block &b = m_blocks[i];
+
+        if (b.sealed)
+        {
+            for (int k = 0; k < b.styles.size(); ++k)
+                live->setBit(b.styles[k]);
+
+            continue;
+        }
+
+        const Cell *cells = b.cells.constData();
+
+        for (int k = 0, n = b.cells.size(); k < n; ++k)
+            live->setBit(cells[k].style);
+    }
+}
+
+void Scrollback::shiftOffsets(Block &b, int index, int delta)
+{
+    int *offsets = b.offsets.data();
+
+    for (int i = index + 1; i < b.offsets.size(); ++i)
+        offsets[i] += delta;
+}
+
+const Scrollback::Block &Scrollback::load(int block) const
+{
+    const Block &b = m_blocks[block];
+    if (!b.sealed)
+        return b;
+
+    int id = m_blocksRemoved + block,
+        pos = m_cache.indexOf(id);
+
+    if (pos >= 0)
+    {
+        m_cache.move(pos, 0);
+        return b;
+    }
+
+    // Not cached, so decompress it, making room by dropping the cells of the
+    // least recently used block
+    QByteArray raw = unpack(b);
+
+    b.cells.resize(raw.size() / sizeof(Cell));
+    memcpy(b.cells.data(), raw.constData(), b.cells.size() * sizeof(Cell));
+
+    m_cache.prepend(id);
+
+    if (m_cache.size() > CACHE_SIZE)
+        m_blocks[m_cache.takeLast() - m_blocksRemoved].cells = QVector<Cell>();
+
+    return b;
+}
+
+Scrollback::Block &Scrollback::modify(int block)
+{
+    Block &b = m_blocks[block];
+    if (!b.sealed)
+        return b;
+
+    load(block);
+    m_cache.removeOne(m_blocksRemoved + block);
+
+    // Any space the block used in the spill file is simply abandoned; this
+    // only happens if the cursor moves back into old history
+    b.sealed = false;
+    b.styles = QVector<ushort>();
+    b.packed = QByteArray();
+    b.spillOffset = -1;
+    b.spillSize = 0;
+
+    return b;
+}
+
+void Scrollback::seal(int block)
+{
+    Block &b = m_blocks[block];
+    if (b.sealed)
+        return;
+
+    // Note the styles while the cells are at hand. They come in runs, so
+    // only the first cell of each run needs sorting
+    const Cell *cells = b.cells.constData();
+    int n = b.cells.size();
+
+    b.styles.clear();
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (i == 0 || cells[i].style != cells[i - 1].style)
+            b.styles.append(cells[i].style);
+    }
+
+    std::sort(b.styles.begin(), b.styles.end());
+    b.styles.erase(std::unique(b.styles.begin(), b.styles.end()),
+                   b.styles.end());
+    b.styles.squeeze();
+
+    // Level 1 trades a little compression for speed. Terminal output is
+    // repetitive enough that it still shrinks several times over.
+    b.packed = qCompress(reinterpret_cast<const uchar *>(b.cells.constData()),
+                         b.cells.size() * sizeof(Cell), 1);
+
+    b.cells = QVector<Cell>();
+    b.sealed = true;
+
+    if (m_spill)
+        spill(b);
+}
+
+void Scrollback::spill(Block &b)
+{
+    if (!m_spillFile)
+    {
+        m_spillFile = new QTemporaryFile;
+
+        if (!m_spillFile->open())
+        {
+            qWarning("Scrollback: could not create spill file; "
+                     "keeping scrollback in memory");
+
+            delete m_spillFile;
+            m_spillFile = 0;
+            m_spill = false;
+            return;
+        }
+    }
+
+    qint64 offset = m_spillFile->size();
+
+    if (!m_spillFile->seek(offset) ||
+        m_spillFile->write(b.packed) != b.packed.size())
+    {
+        return;
+    }
+
+    b.spillOffset = offset;
+    b.spillSize = b.packed.size();
+    b.packed = QByteArray();
+}
+
+QByteArray Scrollback::unpack(const Block &b) const
+{
+    if (b.spillOffset < 0)
+        return qUncompress(b.packed);
+
+    // Writes may still be sitting in QFile's buffer
+    m_spillFile->flush();
+
+    uchar *data = m_spillFile->map(b.spillOffset, b.spillSize);
+    if (data)
+    {
+        QByteArray ret = qUncompress(data, b.spillSize);
+        m_spillFile->unmap(data);
+
+        return ret;
+    }
+
+    // Fall back to reading if mapping isn't supported
+    m_spillFile->seek(b.spillOffset);
+    return qUncompress(m_spillFile->read(b.spillSize));
+}
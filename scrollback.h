@@ -0,0 +1,179 @@
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include "cell.h"
+
+#include <QBitArray>
+#include <QByteArray>
+#include <QChar>
+#include <QList>
+#include <QTemporaryFile>
+#include <QVector>
+
+/** Storage for the canonical lines of a History buffer.
+ *
+ *  Lines are grouped into blocks of BLOCK_SIZE consecutive lines, and the
+ *  cells of every line in a block are stored back to back in one array. This
+ *  keeps the per-line overhead down to a single offset, and means a line's
+ *  cells are always contiguous in memory.
+ *
+ *  Growing or shrinking a line moves the cells of the lines after it in the
+ *  same block. Output almost always goes to the last line, which has nothing
+ *  after it, so in practice this is rare and bounded by the block size.
+ *
+ *  Only the newest HOT_BLOCKS blocks are kept expanded. Older blocks are
+ *  sealed: their cells are compressed with qCompress() and freed, while their
+ *  line offsets stay expanded so lengths can be read without touching the
+ *  cells. Reading the cells of a sealed block decompresses it into a small
+ *  most-recently-used cache of CACHE_SIZE blocks. Modifying a sealed block
+ *  unseals it for good. Sealing also notes which style ids the block uses,
+ *  so markStyles() never has to decompress anything.
+ *
+ *  If spilling is enabled, sealed blocks are moved out of memory altogether:
+ *  their compressed cells are appended to a temporary file, and mapped back in
+ *  with QFile::map() when they need to be decompressed. All that remains in
+ *  memory for a spilled block is its line offsets and its position in the
+ *  file. The file is deleted when the Scrollback is destroyed.
+ */
+class Scrollback
+{
+public:
+    /** The number of lines per block */
+    static const int BLOCK_SIZE = 64;
+
+    /** The number of newest blocks that are never sealed */
+    static const int HOT_BLOCKS = 4;
+
+    /** The number of sealed blocks kept decompressed at once */
+    static const int CACHE_SIZE = 8;
+
+    Scrollback();
+    ~Scrollback();
+
+    /** Returns the number of lines */
+    int numLines() const;
+
+    /** Returns the number of cells in the given line */
+    int length(int line) const;
+
+    /** Returns the cells of the given line. The pointer is valid until the
+     *  next call that modifies the scrollback, or until cells() has been
+     *  called for lines in CACHE_SIZE other sealed blocks.
+     */
+    const Cell *cells(int line) const;
+
+    /** Adds an empty line to the end of the scrollback */
+    void appendLine();
+
+    /** Removes the first n lines, along with their cells. n must be a
+     *  multiple of BLOCK_SIZE, so this only ever drops whole blocks.
+     */
+    void removeFront(int n);
+
+    /** Overwrites the cell at the given column, or appends a cell to the line
+     *  if col is equal to the line's length
+     */
+    void setCell(int line, int col, const Cell &cell);
+
+    /** Writes n cells with the given characters and style, starting at the
+     *  given column. Existing cells are overwritten, and the line grows if
+     *  the text runs past its end. col must be at most the line's length.
+     */
+    void write(int line, int col, const QChar *text, int n, ushort style);
+
+    /** Inserts n copies of the given cell before the given column */
+    void insert(int line, int col, int n, const Cell &fill);
+
+    /** Removes n cells starting at the given column */
+    void remove(int line, int col, int n);
+
+    /** Removes every cell at or after the given column */
+    void truncate(int line, int col);
+
+    /** Sets the bit for the style id of every cell in the scrollback. Only
+     *  the cells of unsealed blocks are read; sealed and spilled blocks use
+     *  the ids noted when they were sealed
+     */
+    void markStyles(QBitArray *live) const;
+
+    /** Gets or sets whether sealed blocks are spilled to disk. This only
+     *  affects blocks sealed after the call.
+     */
+    bool spillToDisk() const;
+    void setSpillToDisk(bool spill);
+
+private:
+    struct Block
+    {
+        Block() : sealed(false), spillOffset(-1), spillSize(0) { }
+
+        /** The cells of every line in this block, back to back. For a sealed
+         *  block this is only filled in while the block is in m_cache.
+         */
+        mutable QVector<Cell> cells;
+
+        /** offsets[i] is the index into cells where line i of this block
+         *  begins. There is one extra entry at the end, which is always equal
+         *  to cells.size()
+         */
+        QVector<int>    offsets;
+
+        /** True if cells has been compressed into packed */
+        bool            sealed;
+
+        /** The style ids used by a sealed block's cells, sorted */
+        QVector<ushort> styles;
+
+        /** The compressed cells of a sealed block, unless it was spilled */
+        QByteArray      packed;
+
+        /** Where the compressed cells of a spilled block are in m_spillFile,
+         *  or -1 if this block hasn't been spilled
+         */
+        qint64          spillOffset;
+        int             spillSize;
+    };
+
+    /** A QList so whole blocks can be dropped from the front in O(1) */
+    QList<Block>        m_blocks;
+    int                 m_numLines;
+
+    /** The number of blocks removeFront() has dropped so far. Adding this to
+     *  an index into m_blocks gives a block number that doesn't change when
+     *  blocks are removed.
+     */
+    int                 m_blocksRemoved;
+
+    /** The block numbers of the sealed blocks whose cells are currently
+     *  decompressed, most recently used first
+     */
+    mutable QList<int>  m_cache;
+
+    /** See spillToDisk(). The file is created when the first block spills */
+    bool                m_spill;
+    QTemporaryFile     *m_spillFile;
+
+    /** Returns the given block, decompressing its cells if it is sealed */
+    const Block &load(int block) const;
+
+    /** Returns the given block for modification, unsealing it if needed */
+    Block &modify(int block);
+
+    /** Compresses the cells of the given block and frees them */
+    void seal(int block);
+
+    /** Moves the compressed cells of a sealed block to m_spillFile. Leaves
+     *  the block in memory if the file can't be written.
+     */
+    void spill(Block &b);
+
+    /** Decompresses the cells of a sealed block, wherever they are stored */
+    QByteArray unpack(const Block &b) const;
+
+    /** Adds delta to the offsets of every line after the given one in its
+     *  block
+     */
+    void shiftOffsets(Block &b, int index, int delta);
+};
+
+#endif // SCROLLBACK_H
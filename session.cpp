@@ -0,0 +1,348 @@
+#include "session.h"
+
+#include "latencytrace.h"
+
+#include <QMetaObject>
+
+Session::Session()
+    : m_shell(Shell::create()),
+      m_chars(&m_history),
+      m_frame(0),
+      m_notified(0),
+      m_publishQueued(false),
+      m_syncTimer(this),
+      m_rows(0),
+      m_cols(0),
+      m_top(-1),
+      m_viewportFixed(false),
+      m_cursorRow(0),
+      m_cursorCol(0),
+      m_damaged(false),
+      m_serial(0),
+      m_writes(0),
+      m_evicted(0),
+      m_formFeeds(0)
+{
+    // UI-level escape sequences go straight through to the view. Everything
+    // else is handled by m_history
+    connect(&m_chars, SIGNAL(bell()), SIGNAL(bell()));
+    connect(&m_chars, SIGNAL(setCursorVisible(bool)),
+                      SIGNAL(setCursorVisible(bool)));
+    connect(&m_chars, SIGNAL(setWindowTitle(const QString&)),
+                      SIGNAL(setWindowTitle(const QString&)));
+
+    // Collect history events into the next frame
+    connect(&m_history, SIGNAL(cursorMoved(int, int)),
+                        SLOT(onHistoryCursorMoved(int, int)));
+    connect(&m_history, SIGNAL(updated()),
+                        SLOT(onHistoryUpdated()));
+    connect(&m_history, SIGNAL(scrollToBottom()),
+                        SLOT(onHistoryScrollToBottom()));
+    connect(&m_history, SIGNAL(rowsEvicted(int)),
+                        SLOT(onHistoryRowsEvicted(int)));
+    connect(&m_history, SIGNAL(screenUpdated(int, int, int, int, int)),
+                        SLOT(onHistoryScreenUpdated(int, int, int, int, int)));
+
+    // LWT_SCROLLBACK overrides the scrollback limit in lines. Zero means
+    // unlimited, in which case old scrollback is spilled to disk
+    QByteArray scrollback = qgetenv("LWT_SCROLLBACK");
+    if (!scrollback.isEmpty())
+    {
+        bool ok;
+        int lines = scrollback.toInt(&ok);
+
+        if (ok)
+        {
+            m_history.setMaxLines(lines);
+            m_history.setSpillToDisk(lines <= 0);
+        }
+    }
+
+    // Parented to the session, so it moves to the session's thread with it
+    m_syncTimer.setSingleShot(true);
+    m_syncTimer.setInterval(SYNC_TIMEOUT);
+    connect(&m_syncTimer, SIGNAL(timeout()), SLOT(onSyncTimeout()));
+
+    connect(m_shell, SIGNAL(readyRead()), SLOT(onShellReadyRead()));
+    connect(m_shell, SIGNAL(closed()), SIGNAL(closed()));
+
+    // Everything but the thread object itself lives on the session's thread
+    m_shell->moveToThread(&m_thread);
+    m_history.moveToThread(&m_thread);
+    m_chars.moveToThread(&m_thread);
+    moveToThread(&m_thread);
+}
+
+Session::~Session()
+{
+    // The shell has to be closed on the thread it was opened on
+    if (m_thread.isRunning())
+    {
+        QMetaObject::invokeMethod(this, "doStop", Qt::BlockingQueuedConnection);
+        m_thread.wait();
+    }
+
+    delete m_shell;
+    delete m_frame.fetchAndStoreOrdered(0);
+}
+
+void Session::start()
+{
+    m_thread.start();
+    QMetaObject::invokeMethod(this, "doStart", Qt::QueuedConnection);
+}
+
+Frame *Session::takeFrame()
+{
+    // Clear the flag first: a frame published after this point raises
+    // frameReady() again, even if we end up taking it below
+    m_notified.fetchAndStoreOrdered(0);
+    return m_frame.fetchAndStoreOrdered(0);
+}
+
+bool Session::write(const QString &input)
+{
+    return m_shell->write(input.toUtf8(), InputQueue::Typed);
+}
+
+bool Session::paste(const QString &text)
+{
+    // Terminals send Enter as CR, and pasted line breaks are no different
+    QString input(text);
+    input.replace("\r\n", "\r");
+    input.replace('\n', '\r');
+
+    return m_shell->write(input.toUtf8(), InputQueue::Pasted);
+}
+
+void Session::resize(int rows, int cols)
+{
+    QMetaObject::invokeMethod(this, "doResize", Qt::QueuedConnection,
+                              Q_ARG(int, rows), Q_ARG(int, cols));
+}
+
+void Session::scrollTo(int row)
+{
+    QMetaObject::invokeMethod(this, "doScrollTo", Qt::QueuedConnection,
+                              Q_ARG(int, row));
+}
+
+void Session::doStart()
+{
+    m_shell->open();
+}
+
+void Session::doResize(int rows, int cols)
+{
+    m_rows = rows;
+    m_cols = cols;
+
+    if (!m_viewportFixed)
+        m_history.onViewportResized(rows, cols);
+
+    if (m_shell)
+        m_shell->resize(rows, cols);
+
+    schedulePublish();
+}
+
+void Session::doScrollTo(int row)
+{
+    m_top = qMax(row, 0);
+    schedulePublish();
+}
+
+void Session::doStop()
+{
+    if (m_shell)
+    {
+        m_shell->disconnect(this);
+        m_shell->close();
+
+        delete m_shell;
+        m_shell = 0;
+    }
+
+    // Timers can only be stopped on their own thread, and the timer itself
+    // is destroyed on the GUI thread, after this one has finished
+    m_syncTimer.stop();
+
+    m_thread.quit();
+}
+
+void Session::onShellReadyRead()
+{
+    if (!m_shell)
+        return;
+
+    // Parse the output where it is, freeing each piece as soon as it's done
+    // so the shell driver can keep reading. Stop after a buffer's worth, so
+    // frames and user input still get a turn during a flood
+    int total = 0, n = 0;
+
+    m_history.beginWrite();
+
+    while (total < Shell::OUTPUT_SIZE)
+    {
+        // Output replayed from a recording is parsed at the size it was
+        // recorded at, whatever the size of the window
+        int rows, cols;
+
+        if (m_shell->takeViewport(&rows, &cols))
+        {
+            m_viewportFixed = true;
+            m_history.onViewportResized(rows, cols);
+            schedulePublish();
+            continue;
+        }
+
+        const char *data = m_shell->peek(&n);
+        if (n == 0)
+            break;
+
+        m_chars.parse(data, n);
+        m_shell->consume(n);
+
+        total += n;
+    }
+
+    m_history.endWrite();
+
+    // peek() didn't come back empty, so no readyRead() is coming for the
+    // rest; come back for it after everything else that's queued
+    if (n > 0)
+        QMetaObject::invokeMethod(this, "onShellReadyRead", Qt::QueuedConnection);
+
+    if (total == 0)
+        return;
+
+    // New output scrolls the view back to the bottom
+    m_top = -1;
+    ++m_writes;
+
+    LatencyTrace::mark(LatencyTrace::OutputParsed, m_writes);
+
+    // Don't show anything until the application finishes its frame. The
+    // timeout runs from the read that started the frame
+    if (m_history.synchronizedOutput())
+    {
+        if (!m_syncTimer.isActive())
+            m_syncTimer.start();
+
+        return;
+    }
+
+    m_syncTimer.stop();
+    schedulePublish();
+}
+
+void Session::onSyncTimeout()
+{
+    m_history.endSynchronizedOutput();
+    schedulePublish();
+}
+
+void Session::onHistoryCursorMoved(int row, int col)
+{
+    m_cursorRow = row;
+    m_cursorCol = col;
+}
+
+void Session::onHistoryUpdated()
+{
+    m_damage.all = true;
+    m_damaged = true;
+}
+
+void Session::onHistoryScrollToBottom()
+{
+    ++m_formFeeds;
+}
+
+void Session::onHistoryRowsEvicted(int rows)
+{
+    m_evicted += rows;
+
+    if (m_top >= 0)
+        m_top = qMax(m_top - rows, 0);
+}
+
+void Session::onHistoryScreenUpdated(int top, int bottom, int scrolled,
+                                     int firstRow, int lastRow)
+{
+    // Two partial updates can't be described as one, so fall back to
+    // repainting everything if there's already one waiting
+    if (m_damaged)
+    {
+        m_damage.all = true;
+        return;
+    }
+
+    m_damage.all = false;
+    m_damage.scrollTop = top;
+    m_damage.scrollBottom = bottom;
+    m_damage.scrolled = scrolled;
+    m_damage.firstRow = firstRow;
+    m_damage.lastRow = lastRow;
+    m_damaged = true;
+}
+
+void Session::publish()
+{
+    m_publishQueued = false;
+
+    // Not in the middle of the application's frame, e.g. for a resize or a
+    // scroll. Whatever ends the frame publishes the whole thing
+    if (m_history.synchronizedOutput())
+        return;
+
+    Frame *frame = new Frame;
+
+    frame->serial = ++m_serial;
+    frame->numLines = m_history.numLines();
+    frame->alternate = m_history.alternateScreen();
+    frame->writes = m_writes;
+    frame->evicted = m_evicted;
+    frame->formFeeds = m_formFeeds;
+
+    // Cover the rows in view, plus the partially visible ones at the edges
+    int top = m_top;
+    if (top < 0)
+        top = frame->numLines - m_rows - 1;
+
+    frame->firstRow = qMax(qMin(top, frame->numLines - 1), 0);
+    frame->lastRow = qMin(frame->firstRow + m_rows + 2, frame->numLines);
+    frame->renderData = m_history.renderData(frame->firstRow,
+                                             frame->lastRow, 1);
+
+    Cell cell = m_history.cellAt(m_cursorRow, m_cursorCol);
+
+    frame->cursorRow = m_cursorRow;
+    frame->cursorCol = m_cursorCol;
+    frame->cursorChar = QChar(cell.ch);
+    frame->cursorStyle = m_history.style(cell);
+
+    // A frame published without any changes (e.g. for scrollTo()) still has
+    // to be painted in full
+    frame->damage = m_damage;
+    if (!m_damaged)
+        frame->damage.all = true;
+
+    m_damage = Screen::Damage();
+    m_damaged = false;
+
+    // If the GUI hasn't taken the previous frame by now, it never will
+    delete m_frame.fetchAndStoreOrdered(frame);
+
+    if (m_notified.testAndSetOrdered(0, 1))
+        emit frameReady();
+}
+
+void Session::schedulePublish()
+{
+    if (m_publishQueued)
+        return;
+
+    m_publishQueued = true;
+    QMetaObject::invokeMethod(this, "publish", Qt::QueuedConnection);
+}
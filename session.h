@@ -0,0 +1,166 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "frame.h"
+#include "history.h"
+#include "shell.h"
+#include "specialchars.h"
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+
+/** A running shell and the model of its output.
+ *
+ *  Each terminal has its own Session, which owns the shell driver, the
+ *  SpecialChars parser and the History on a dedicated thread. Shell output is
+ *  read, parsed and stored there, so a flood of output never blocks keyboard
+ *  handling or painting on the GUI thread.
+ *
+ *  After handling a batch of output the session builds a Frame and publishes
+ *  it with an atomic pointer swap. The GUI picks up the newest frame with
+ *  takeFrame() when frameReady() is raised; frames it didn't get to in time
+ *  are simply replaced.
+ *
+ *  While the application is drawing a synchronized update (DEC private mode
+ *  2026), no frames are published at all until it finishes, or until
+ *  SYNC_TIMEOUT milliseconds have passed since it started.
+ *
+ *  Apart from the constructor and destructor, the public methods are safe to
+ *  call from any thread. Methods that change the session are queued to its
+ *  thread and take effect asynchronously; input is queued by the shell
+ *  driver, which writes it from its own I/O thread.
+ */
+class Session : public QObject
+{
+    Q_OBJECT
+
+public:
+    Session();
+    ~Session();
+
+    /** Starts the session's thread and opens the shell on it. Connect to the
+     *  session's signals before calling this
+     */
+    void start();
+
+    /** Returns the most recently published frame, or null if there hasn't
+     *  been a new one since the last call. The caller takes ownership of the
+     *  frame
+     */
+    Frame *takeFrame();
+
+    /** Queues typed or pasted input to be written to the shell. Typed input
+     *  goes ahead of any paste still being written. Returns false if the
+     *  input was refused because too much is already waiting
+     */
+    bool write(const QString &input);
+    bool paste(const QString &text);
+
+    /** Tells the session the size of the viewport, in rows and columns.
+     *  See History::onViewportResized(). When replaying a recording, the
+     *  history keeps the recorded size instead
+     */
+    void resize(int rows, int cols);
+
+    /** Tells the session the view was scrolled so that the given row is at
+     *  the top. Frames cover those rows until the shell writes again, at
+     *  which point they go back to covering the bottom of the history
+     */
+    void scrollTo(int row);
+
+    /** The longest a synchronized update can hold back frames, in
+     *  milliseconds
+     */
+    static const int SYNC_TIMEOUT = 150;
+
+signals:
+    /** Raised when a new frame is ready to be taken */
+    void frameReady();
+
+    /** Forwarded from SpecialChars */
+    void bell();
+    void setCursorVisible(bool visible);
+    void setWindowTitle(const QString &title);
+
+    /** Raised when the shell binary closes */
+    void closed();
+
+private slots:
+    void doStart();
+    void doResize(int rows, int cols);
+    void doScrollTo(int row);
+    void doStop();
+
+    void onShellReadyRead();
+    void onSyncTimeout();
+
+    void onHistoryCursorMoved(int row, int col);
+    void onHistoryUpdated();
+    void onHistoryScrollToBottom();
+    void onHistoryRowsEvicted(int rows);
+    void onHistoryScreenUpdated(int top, int bottom, int scrolled,
+                                int firstRow, int lastRow);
+
+    /** Builds a frame from the current state and publishes it */
+    void publish();
+
+private:
+    QThread                 m_thread;
+
+    Shell                  *m_shell;
+    History                 m_history;
+    SpecialChars            m_chars;
+
+    /** The newest published frame, until the GUI takes it */
+    QAtomicPointer<Frame>   m_frame;
+
+    /** Set when frameReady() has been raised for a frame that hasn't been
+     *  taken yet, so a busy GUI thread isn't sent a signal per frame
+     */
+    QAtomicInt              m_notified;
+
+    /** Set while a call to publish() is queued */
+    bool                    m_publishQueued;
+
+    /** Started when the application begins a synchronized update. Stopped
+     *  by doStop(), on the session's thread
+     */
+    QTimer                  m_syncTimer;
+
+    /** The size of the viewport, and the row requested by scrollTo(). A
+     *  negative row means frames cover the bottom of the history
+     */
+    int                     m_rows;
+    int                     m_cols;
+    int                     m_top;
+
+    /** Set once the shell has dictated the viewport size (see
+     *  Shell::takeViewport()). From then on, resize() only changes how
+     *  many rows frames cover
+     */
+    bool                    m_viewportFixed;
+
+    /** The cursor position as of the last write batch */
+    int                     m_cursorRow;
+    int                     m_cursorCol;
+
+    /** What changed since the last frame, and whether anything did */
+    Screen::Damage          m_damage;
+    bool                    m_damaged;
+
+    /** See the Frame members of the same names */
+    int                     m_serial;
+    int                     m_writes;
+    int                     m_evicted;
+    int                     m_formFeeds;
+
+    /** Queues a call to publish(), unless one is already queued. Reads that
+     *  arrive in a burst end up in a single frame
+     */
+    void schedulePublish();
+};
+
+#endif // SESSION_H
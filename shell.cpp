@@ -1,10 +1,56 @@
 
 #include "shell.h"
 
+#include "latencytrace.h"
 #include "processshell.h"
+#include "recording.h"
+#include "replayshell.h"
+
+#include <QMutexLocker>
+
+#ifdef Q_OS_LINUX
+#include "ptyshell.h"
+#endif
+
+Shell::Shell()
+    : m_output(OUTPUT_SIZE),
+      m_readyReadPending(0),
+      m_recording(0),
+      m_viewportCount(0)
+{ }
+
+Shell::~Shell()
+{
+    delete m_recording;
+}
 
 Shell* Shell::create()
 {
+    Shell *shell = createDriver();
+
+    QString record = QString::fromLocal8Bit(qgetenv("LWT_RECORD"));
+
+    if (!record.isEmpty() && !shell->startRecording(record))
+        qWarning("Could not create %s to record to", qPrintable(record));
+
+    return shell;
+}
+
+Shell* Shell::createDriver()
+{
+    QString replay = QString::fromLocal8Bit(qgetenv("LWT_REPLAY"));
+
+    if (!replay.isEmpty())
+        return new ReplayShell(replay, qgetenv("LWT_REPLAY_FAST").isEmpty());
+
+#ifdef Q_OS_LINUX
+    // Run the user's shell on a real terminal
+    QString binary = QString::fromLocal8Bit(qgetenv("SHELL"));
+    if (binary.isEmpty())
+        binary = "/bin/sh";
+
+    return new PtyShell(binary);
+#else
     // TODO binary information belongs in a configuration file
     QString binary("C:\\MinGW\\msys\\1.0\\bin\\sh.exe");
 
@@ -13,5 +59,152 @@ Shell* Shell::create()
     args.append("-i");
 
     return new ProcessShell(binary, args);
+#endif
+}
+
+
+bool Shell::write(const QByteArray &data, InputQueue::Kind kind)
+{
+    if (!m_input.append(data, kind))
+        return false;
+
+    inputQueued();
+    return true;
+}
+
+void Shell::resize(int rows, int cols)
+{
+    if (m_recording)
+    {
+        QMutexLocker lock(&m_recordingLock);
+        m_recording->writeResize(rows, cols);
+    }
+
+    resizeTerminal(rows, cols);
+}
+
+bool Shell::startRecording(const QString &path)
+{
+    Recording *recording = new Recording();
+
+    if (!recording->create(path))
+    {
+        delete recording;
+        return false;
+    }
+
+    delete m_recording;
+    m_recording = recording;
+
+    return true;
 }
 
+const char *Shell::peek(int *n)
+{
+    const char *ret = m_output.readBuffer(n);
+
+    if (*n == 0)
+    {
+        // Caught up. Output committed from here on raises readyRead() again;
+        // check once more for anything committed before the flag was cleared
+        m_readyReadPending.fetchAndStoreOrdered(0);
+        ret = m_output.readBuffer(n);
+    }
+
+    // Don't hand out output past a change of viewport size
+    if (*n > 0 && m_viewportCount.loadAcquire() > 0)
+    {
+        QMutexLocker lock(&m_viewportLock);
+
+        uint left = m_viewports.first().position - m_output.released();
+        if (left < (uint)*n)
+            *n = left;
+    }
+
+    return ret;
+}
+
+void Shell::consume(int n)
+{
+    if (m_output.release(n))
+        resumeOutput();
+}
+
+bool Shell::takeViewport(int *rows, int *cols)
+{
+    if (m_viewportCount.loadAcquire() == 0)
+        return false;
+
+    QMutexLocker lock(&m_viewportLock);
+
+    const Viewport &v = m_viewports.first();
+    if (v.position != m_output.released())
+        return false;
+
+    *rows = v.rows;
+    *cols = v.cols;
+
+    m_viewports.removeFirst();
+    m_viewportCount.fetchAndAddOrdered(-1);
+
+    return true;
+}
+
+char *Shell::outputBuffer(int *n)
+{
+    return m_output.writeBuffer(n);
+}
+
+void Shell::commitOutput(int n)
+{
+    if (m_recording)
+    {
+        // The output is still where outputBuffer() said it would go
+        int space;
+        const char *data = m_output.writeBuffer(&space);
+
+        QMutexLocker lock(&m_recordingLock);
+        m_recording->writeOutput(data, n);
+    }
+
+    m_output.commit(n);
+
+    LatencyTrace::mark(LatencyTrace::OutputRead);
+
+    if (m_readyReadPending.testAndSetOrdered(0, 1))
+        emit readyRead();
+}
+
+void Shell::requestViewport(int rows, int cols)
+{
+    Viewport v;
+    v.position = m_output.committed();
+    v.rows = rows;
+    v.cols = cols;
+
+    {
+        QMutexLocker lock(&m_viewportLock);
+        m_viewports.append(v);
+        m_viewportCount.fetchAndAddOrdered(1);
+    }
+
+    // Always wake the receiver: it may have just caught up with the output,
+    // and wouldn't look for the new size until more output came in
+    m_readyReadPending.fetchAndStoreOrdered(1);
+    emit readyRead();
+}
+
+bool Shell::outputDrained() const
+{
+    return m_output.released() == m_output.committed();
+}
+
+InputQueue &Shell::input()
+{
+    return m_input;
+}
+
+bool Shell::waitForOutputSpace()
+{
+    return m_output.markFull();
+}
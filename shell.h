@@ -1,31 +1,54 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include "bytering.h"
+#include "inputqueue.h"
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
 #include <QObject>
 
+class Recording;
+
 /** Abstract base for a shell driver.
  *  
  *  Shell drivers manage interaction with the shell binary. All user input is
  *  funneled through the shell via the driver, and the driver produces shell
  *  output which is rendered to the screen via the TerminalWidget.
+ *
+ *  Output is collected in a fixed-size ring buffer rather than handed out in
+ *  freshly allocated chunks. When the receiver falls behind and the buffer
+ *  fills up, drivers stop reading from the shell, so a program that writes
+ *  faster than we can parse is held up by the operating system (its writes
+ *  block) instead of growing our memory.
  */
 class Shell : public QObject
 {
     Q_OBJECT
 
 public:
+    Shell();
+    virtual ~Shell();
+
     /** Instantiates the proper shell driver for the current platform.
      *
-     *  If there is no platform-specific driver for the platform this
-     *  application is being compiled for, create() returns a new ProcessShell
-     *  as a fallback.
+     *  On Linux this is a PtyShell running the user's shell. If there is no
+     *  platform-specific driver for the platform this application is being
+     *  compiled for, create() returns a new ProcessShell as a fallback.
+     *
+     *  For reproducing performance problems, LWT_RECORD=<file> in the
+     *  environment records the shell's output to <file>, and
+     *  LWT_REPLAY=<file> replays such a recording with a ReplayShell instead
+     *  of running a shell (as fast as possible if LWT_REPLAY_FAST is set).
      */
     static Shell* create();
 
     /** Opens this shell. If necessary, a shell binary will be spawned.
      *
      *  This action can cause the shell to produce output. Thus you should
-     *  connect to this shell's read and closed signals before you call open()
+     *  connect to this shell's readyRead and closed signals before you call
+     *  open()
      */
     virtual void open() = 0;
 
@@ -33,41 +56,173 @@ public:
      *  necessary. 
      *
      *  This action can cause the shell to produce output. Thus you should not
-     *  disconnect from the shell's read and closed signals until after you've
-     *  called close().
+     *  disconnect from the shell's readyRead and closed signals until after
+     *  you've called close().
      */
     virtual void close() = 0;
 
     /** Indicates whether the shell binary is running and has not exited */
     virtual bool isOpen() = 0;
 
-    /** Writes the given data to the shell's stdin stream. 
+    /** Queues the given data to be written to the shell's stdin stream.
      *
-     *  The shell driver is allowed to convert the string data to a different
-     *  character encoding as necessary. For the most part, shell drivers will
-     *  convert to ASCII or UTF-8.
+     *  The data is written by the driver in the background, as fast as the
+     *  shell reads it; this call never blocks. Typed input is written ahead
+     *  of any paste that is still in progress (see InputQueue).
      *
-     *  If the shell cannot accept all of the given input buffer in one call,
-     *  this method returns the data that could not be written. If no data
-     *  could be written, this method returns the entire input buffer. This
-     *  call is not allowed to block until the shell is ready to receive all
-     *  bytes. It must be safe to call this method on the thread that runs the
-     *  application's event queue without losing responsiveness.
+     *  Returns false if the data doesn't fit in the queue, in which case
+     *  none of it is written. Safe to call from any thread.
      *
-     *  @param buf  The data to write
-     *  @return     The data that could not be written
+     *  @param data The bytes to write, normally UTF-8
+     *  @param kind Whether the data was typed or pasted
      */
-    virtual QString write(const QString &buf) = 0;
+    bool write(const QByteArray &data,
+               InputQueue::Kind kind = InputQueue::Typed);
+
+    /** Tells the shell the size of the terminal in rows and columns. See
+     *  resizeTerminal()
+     */
+    void resize(int rows, int cols);
+
+    /** Starts writing all of the shell's output, and every resize(), to the
+     *  given file (see Recording). Call before open(). Returns false if the
+     *  file couldn't be created
+     */
+    bool startRecording(const QString &path);
+
+    /** Returns the oldest output that hasn't been consumed yet, and sets *n
+     *  to the number of bytes available there. If there is no output left,
+     *  *n is set to zero and readyRead() will be raised for the next output.
+     *
+     *  The data is exactly what the shell wrote, normally UTF-8. It may end
+     *  in the middle of a multi-byte character or an escape sequence;
+     *  SpecialChars deals with that.
+     *
+     *  Only the receiver of readyRead() may call this and consume(), on the
+     *  thread the shell belongs to.
+     */
+    const char *peek(int *n);
+
+    /** Marks the first n bytes returned by peek() as processed, making room
+     *  for more output
+     */
+    void consume(int n);
+
+    /** Returns true, and the viewport size in rows and columns, if the
+     *  driver needs the output from here on to be handled at a particular
+     *  size (see requestViewport()). peek() stops short of the point where
+     *  the size changes, so call this before each peek().
+     *
+     *  Same thread restrictions as peek().
+     */
+    bool takeViewport(int *rows, int *cols);
+
+    /** The size of the output buffer in bytes */
+    static const int OUTPUT_SIZE = 65536;
 
 signals:
-    /** Emitted whenever the shell writes to stdout or stderr
-     *  
-     *  @param input The data written to stdout or stderr
+    /** Emitted when the shell has written to stdout or stderr and output is
+     *  waiting to be peek()ed.
+     *
+     *  This is raised only once until the receiver has drained the output
+     *  (i.e. until peek() has come back empty), so a burst of output costs a
+     *  single signal no matter how many reads it took.
      */
-    void read(const QString &data);
+    void readyRead();
 
     /** Emitted when the shell binary closes */
     void closed();
+
+protected:
+    /** Methods for drivers to fill the output buffer with. Apart from
+     *  resumeOutput(), these may be called from any one thread.
+     */
+
+    /** Returns where the next output goes, and sets *n to the number of
+     *  bytes that fit there. Zero means the buffer is full
+     */
+    char *outputBuffer(int *n);
+
+    /** Makes n bytes written to outputBuffer() available to peek(), and
+     *  raises readyRead() if the receiver isn't already on its way
+     */
+    void commitOutput(int n);
+
+    /** Call when outputBuffer() is full, before waiting for the receiver to
+     *  make room. Returns false if there is room again already. Otherwise
+     *  resumeOutput() is called once there is
+     */
+    bool waitForOutputSpace();
+
+    /** Called on the receiver's thread when consume() makes room after
+     *  waitForOutputSpace() returned true. Drivers should start reading from
+     *  the shell again.
+     *
+     *  Ignored unless overridden.
+     */
+    virtual void resumeOutput() { }
+
+    /** Called by resize(), for drivers that give programs a real terminal.
+     *
+     *  Ignored unless overridden.
+     */
+    virtual void resizeTerminal(int rows, int cols)
+    {
+        Q_UNUSED(rows);
+        Q_UNUSED(cols);
+    }
+
+    /** Input waiting to be written to the shell. Drivers drain it with
+     *  peek() and consume() on their I/O thread
+     */
+    InputQueue &input();
+
+    /** Asks the receiver to handle all output committed after this call at
+     *  the given viewport size, e.g. because it was recorded at that size.
+     *  Call from the same thread as commitOutput()
+     */
+    void requestViewport(int rows, int cols);
+
+    /** Returns true once the receiver has consumed all committed output */
+    bool outputDrained() const;
+
+    /** Called on the writing thread after write() queues input. Drivers
+     *  should arrange for their I/O thread to start draining input()
+     */
+    virtual void inputQueued() = 0;
+
+private:
+    ByteRing m_output;
+    InputQueue m_input;
+
+    /** Set while readyRead() has been raised and the receiver hasn't caught
+     *  up with the output yet
+     */
+    QAtomicInt m_readyReadPending;
+
+    /** Where output is being recorded, if anywhere. Output and resizes come
+     *  from different threads, so writes to it are serialized by the lock
+     */
+    Recording *m_recording;
+    QMutex m_recordingLock;
+
+    /** Viewport sizes from requestViewport(), each with the position in
+     *  the output (see ByteRing::committed()) where it applies. The count is
+     *  kept separately so peek() only takes the lock when there are any
+     */
+    struct Viewport
+    {
+        uint position;
+        int rows;
+        int cols;
+    };
+
+    QList<Viewport> m_viewports;
+    QMutex m_viewportLock;
+    QAtomicInt m_viewportCount;
+
+    /** Picks the driver for create() */
+    static Shell* createDriver();
 };
 
 #endif // SHELL_H
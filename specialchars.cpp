@@ -1,9 +1,19 @@
 
 #include "specialchars.h"
+#include "escapehandler.h"
 
 #include <QDebug>
-#include <QStringList>
-#include <QVector>
+#include <QList>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 // The ASCII Control Characters
 // http://en.wikipedia.org/wiki/ASCII#ASCII_control_characters
@@ -68,8 +78,62 @@
 #define ANSI_SCP        's'     // Save Cursor Position
 #define ANSI_RCP        'u'     // Restore Cursor Position
 
-#define DECTCEM_HIC     'l'     // Hide Cursor
-#define DECTCEM_SHC     'h'     // Show Cursor
+#define DECSTBM         'r'     // Set Top and Bottom Margins
+
+
+// Escape sequences (ESC followed by a single character)
+
+#define DECSC           '7'     // Save Cursor
+#define DECRC           '8'     // Restore Cursor
+#define DECKPAM         '='     // Application Keypad
+#define DECKPNM         '>'     // Normal Keypad
+#define ESC_ST          '\\'    // String Terminator
+
+#define ANSI_SM         'h'     // Set Mode
+#define ANSI_RM         'l'     // Reset Mode
+
+
+// Select Graphic Rendition parameters
+// http://en.wikipedia.org/wiki/ANSI_escape_code#graphics
+
+#define SGR_RESET           0       // Reset all attributes
+#define SGR_BOLD            1       // Bold
+#define SGR_FAINT           2       // Faint
+#define SGR_ITALIC          3       // Italic
+#define SGR_UNDERLINE       4       // Underline
+#define SGR_BLINK           5       // Slow Blink
+#define SGR_RAPID_BLINK     6       // Rapid Blink
+#define SGR_INVERSE         7       // Inverse
+#define SGR_HIDDEN          8       // Conceal
+#define SGR_STRIKEOUT       9       // Crossed Out
+#define SGR_DOUBLE_UNDER    21      // Double Underline
+#define SGR_NORMAL          22      // Neither Bold nor Faint
+#define SGR_NO_ITALIC       23      // Not Italic
+#define SGR_NO_UNDERLINE    24      // Not Underlined
+#define SGR_NO_BLINK        25      // Not Blinking
+#define SGR_NO_INVERSE      27      // Not Inverse
+#define SGR_NO_HIDDEN       28      // Reveal
+#define SGR_NO_STRIKEOUT    29      // Not Crossed Out
+#define SGR_FG              30      // Foreground Color (30-37)
+#define SGR_FG_EXT          38      // Extended Foreground Color
+#define SGR_FG_DEFAULT      39      // Default Foreground Color
+#define SGR_BG              40      // Background Color (40-47)
+#define SGR_BG_EXT          48      // Extended Background Color
+#define SGR_BG_DEFAULT      49      // Default Background Color
+#define SGR_FG_BRIGHT       90      // Bright Foreground Color (90-97)
+#define SGR_BG_BRIGHT       100     // Bright Background Color (100-107)
+
+#define SGR_EXT_RGB         2       // 38;2;r;g;b
+#define SGR_EXT_INDEX       5       // 38;5;n
+
+
+// DEC private modes, set and reset with CSI ? <mode> h/l
+
+#define DECTCEM         25      // Show Cursor
+#define DEC_ALTBUF      47      // Use Alternate Screen Buffer
+#define DEC_ALTBUF_CLR  1047    // Use Alternate Screen Buffer (xterm)
+#define DEC_ALTBUF_CUR  1049    // Save Cursor and Use Alternate Screen Buffer
+#define DEC_SYNC        2026    // Synchronized Output
 
 
 // OS Control Sequences defined by xterm
@@ -82,338 +146,930 @@
 #define XTERM_CCN       4       // Change Color Number
 
 
-SpecialChars::SpecialChars() { }
+// Parser states and actions. See the description of the parser in
+// specialchars.h. Transitions are stored one byte per entry: the action to
+// perform in the high nibble and the state to move to in the low nibble.
+
+#define STATE_GROUND            0   // Printing text
+#define STATE_ESCAPE            1   // Just saw ESC
+#define STATE_ESCAPE_INTER      2   // ESC followed by intermediate bytes
+#define STATE_CSI_ENTRY         3   // Just saw ESC [
+#define STATE_CSI_PARAM         4   // Reading CSI parameters
+#define STATE_CSI_INTER         5   // Reading CSI intermediate bytes
+#define STATE_CSI_IGNORE        6   // Skipping a malformed CSI sequence
+#define STATE_OSC_STRING        7   // Reading an OS command string
+#define STATE_STRING_IGNORE     8   // Skipping a DCS, SOS, PM or APC string
+#define NUM_STATES              9
+
+#define ACTION_NONE             0   // Just change state
+#define ACTION_IGNORE           1   // Drop the character
+#define ACTION_PRINT            2   // Pass the character on as text
+#define ACTION_EXECUTE          3   // Handle a C0 control character
+#define ACTION_CLEAR            4   // Start a new sequence
+#define ACTION_COLLECT          5   // Add an intermediate byte
+#define ACTION_PARAM            6   // Add a parameter byte
+#define ACTION_ESC_DISPATCH     7   // Finish an escape sequence
+#define ACTION_CSI_DISPATCH     8   // Finish a control sequence
+#define ACTION_OSC_PUT          9   // Add a byte to an OS command string
+
+// OS command strings longer than this are truncated rather than buffered
+// forever. Numeric parameters are clamped to MAX_PARAM_VALUE
+#define MAX_OSC_LENGTH          4096
+#define MAX_PARAM_VALUE         65535
+
+static uchar transitions[NUM_STATES][128];
+static bool transitionsBuilt = false;
+
+static void setTransition(int state, int first, int last, int action, int next)
+{
+    for (int c = first; c <= last; ++c)
+        transitions[state][c] = (uchar)((action << 4) | next);
+}
+
+/** Fills in the transition table, following the DEC-compatible parser
+ *  described at http://vt100.net/emu/dec_ansi_parser
+ */
+static void buildTransitions()
+{
+    for (int s = 0; s < NUM_STATES; ++s)
+    {
+        // C0 controls are executed in the middle of most sequences
+        setTransition(s, 0x00, 0x1f, ACTION_EXECUTE, s);
+        setTransition(s, 0x20, 0x7f, ACTION_IGNORE, s);
+
+        // These work from any state
+        setTransition(s, ASCII_CAN, ASCII_CAN, ACTION_EXECUTE, STATE_GROUND);
+        setTransition(s, ASCII_SUB, ASCII_SUB, ACTION_EXECUTE, STATE_GROUND);
+        setTransition(s, ASCII_ESC, ASCII_ESC, ACTION_CLEAR, STATE_ESCAPE);
+    }
+
+    int s = STATE_GROUND;
+    setTransition(s, 0x20, 0x7e, ACTION_PRINT, s);
+    setTransition(s, 0x7f, 0x7f, ACTION_EXECUTE, s);
+
+    s = STATE_ESCAPE;
+    setTransition(s, 0x20, 0x2f, ACTION_COLLECT, STATE_ESCAPE_INTER);
+    setTransition(s, 0x30, 0x7e, ACTION_ESC_DISPATCH, STATE_GROUND);
+    setTransition(s, '[', '[', ACTION_NONE, STATE_CSI_ENTRY);
+    setTransition(s, ']', ']', ACTION_NONE, STATE_OSC_STRING);
+    setTransition(s, 'P', 'P', ACTION_NONE, STATE_STRING_IGNORE);
+    setTransition(s, 'X', 'X', ACTION_NONE, STATE_STRING_IGNORE);
+    setTransition(s, '^', '_', ACTION_NONE, STATE_STRING_IGNORE);
+
+    s = STATE_ESCAPE_INTER;
+    setTransition(s, 0x20, 0x2f, ACTION_COLLECT, s);
+    setTransition(s, 0x30, 0x7e, ACTION_ESC_DISPATCH, STATE_GROUND);
+
+    // Private markers (< = > ?) are only allowed before the parameters. They
+    // are kept so handlers can tell e.g. CSI ? 25 h from CSI 25 h
+    s = STATE_CSI_ENTRY;
+    setTransition(s, 0x20, 0x2f, ACTION_COLLECT, STATE_CSI_INTER);
+    setTransition(s, 0x30, 0x3f, ACTION_PARAM, STATE_CSI_PARAM);
+    setTransition(s, 0x40, 0x7e, ACTION_CSI_DISPATCH, STATE_GROUND);
+
+    s = STATE_CSI_PARAM;
+    setTransition(s, 0x20, 0x2f, ACTION_COLLECT, STATE_CSI_INTER);
+    setTransition(s, 0x30, 0x3b, ACTION_PARAM, s);
+    setTransition(s, 0x3c, 0x3f, ACTION_NONE, STATE_CSI_IGNORE);
+    setTransition(s, 0x40, 0x7e, ACTION_CSI_DISPATCH, STATE_GROUND);
+
+    s = STATE_CSI_INTER;
+    setTransition(s, 0x20, 0x2f, ACTION_COLLECT, s);
+    setTransition(s, 0x30, 0x3f, ACTION_NONE, STATE_CSI_IGNORE);
+    setTransition(s, 0x40, 0x7e, ACTION_CSI_DISPATCH, STATE_GROUND);
+
+    s = STATE_CSI_IGNORE;
+    setTransition(s, 0x40, 0x7e, ACTION_NONE, STATE_GROUND);
+
+    // OS commands end with BEL or ST (ESC \). Other controls are dropped
+    s = STATE_OSC_STRING;
+    setTransition(s, 0x00, 0x17, ACTION_IGNORE, s);
+    setTransition(s, 0x19, 0x19, ACTION_IGNORE, s);
+    setTransition(s, 0x1c, 0x1f, ACTION_IGNORE, s);
+    setTransition(s, ASCII_BEL, ASCII_BEL, ACTION_NONE, STATE_GROUND);
+    setTransition(s, 0x20, 0x7f, ACTION_OSC_PUT, s);
+
+    s = STATE_STRING_IGNORE;
+    setTransition(s, 0x00, 0x17, ACTION_IGNORE, s);
+    setTransition(s, 0x19, 0x19, ACTION_IGNORE, s);
+    setTransition(s, 0x1c, 0x1f, ACTION_IGNORE, s);
+
+    transitionsBuilt = true;
+}
+
+
+/** Returns true if the byte is printable ASCII, i.e. neither a C0 control
+ *  character, DEL, nor part of a multi-byte UTF-8 character
+ */
+static inline bool isPrintableAscii(uchar b)
+{
+    return b > ASCII_US && b < ASCII_DEL;
+}
+
+/** Writes a code point to out as UTF-16, and returns the position after it */
+static inline QChar *putChar(QChar *out, uint c)
+{
+    if (QChar::requiresSurrogates(c))
+    {
+        *out++ = QChar(QChar::highSurrogate(c));
+        *out++ = QChar(QChar::lowSurrogate(c));
+    }
+    else
+    {
+        *out++ = QChar((ushort)c);
+    }
+
+    return out;
+}
+
+
+SpecialChars::SpecialChars(EscapeHandler *handler)
+    : m_handler(handler),
+      m_state(STATE_GROUND),
+      m_numParams(0),
+      m_private(0),
+      m_numIntermediates(0),
+      m_utf8Char(0),
+      m_utf8Needed(0),
+      m_utf8Min(0)
+{
+    if (!transitionsBuilt)
+        buildTransitions();
+}
 
 SpecialChars::~SpecialChars() { }
 
-int SpecialChars::eat(const QString &str, int index)
+void SpecialChars::parse(const char *data, int length)
 {
-    QChar c = str[index];
+    const uchar *p = (const uchar *)data,
+                *end = p + length;
 
-    switch (c.toLatin1())
+    while (p < end)
     {
-        case ASCII_BEL:
-            emit bell();
-            return index + 1;
+        // Text is by far the most common input, so it bypasses the state
+        // machine whenever possible
+        if (m_state == STATE_GROUND && m_utf8Needed == 0)
+        {
+            p = printText(p, end);
+            if (p == end)
+                break;
+        }
 
-        case ASCII_BS:
-            emit moveCursorBy(0, -1);
-            return index + 1;
+        uchar b = *p;
 
-        case ASCII_CR:
-            emit carriageReturn();
-            return index + 1;
+        // A character cut short by a byte that can't continue it decodes to
+        // a replacement character. The byte is then parsed on its own
+        if (m_utf8Needed > 0 && (b & 0xc0) != 0x80)
+        {
+            m_utf8Needed = 0;
+            eat(QChar::ReplacementCharacter);
+            continue;
+        }
 
-        case ASCII_DEL:
-            emit del(1);
-            return index + 1;
+        ++p;
 
-        case ASCII_FF:
-            emit formFeed();
-            return index + 1;
+        uint c;
+        if (decode(b, &c))
+            eat(c);
+    }
+}
 
-        case ASCII_HT:
-            emit horizontalTab();
-            return index + 1;
+const uchar *SpecialChars::printText(const uchar *p, const uchar *end)
+{
+    Q_ASSERT(m_utf8Needed == 0);
 
-        case ASCII_VT:
-            emit verticalTab();
-            return index + 1;
+    QChar *out = m_text;
+
+    // Leaves room for a whole vector, or a surrogate pair, at the end
+    QChar *outEnd = m_text + TEXT_CHUNK - 32;
+
+    while (p < end)
+    {
+        if (out >= outEnd)
+        {
+            m_handler->print(m_text, out - m_text);
+            out = m_text;
+        }
 
-        case ASCII_ESC:
+        // Bulk-convert ASCII a vector at a time. Bytes of 0x80 and up are
+        // negative as signed chars, so one signed compare against 0x20 picks
+        // out both C0 controls and non-ASCII bytes.
+#if defined(__AVX2__)
+        if (end - p >= 32)
         {
-            char cmd;
-            QString args;
-            int ret = index;
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            __m256i special = _mm256_or_si256(
+                        _mm256_cmpgt_epi8(_mm256_set1_epi8(' '), v),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ASCII_DEL)));
 
-            if (parseAnsi(str, &cmd, &args, &ret))
+            if (!_mm256_movemask_epi8(special))
             {
-                // Convert the args string to a list of integers,
-                // since most commands require integer arguments.
-                // Convenient for the case statements below
-                QVector<int> intargs;
-                QStringList parts = args.split(';', QString::SkipEmptyParts);
-                foreach (QString part, parts)
-                {
-                    bool ok = false;
-                    int val = part.toInt(&ok);
-                    if (ok)
-                        intargs.append(val);
-                    else
-                        intargs.append(0xFFFFFFFF);
-                }
-
-                switch (cmd)
-                {
-                    case ANSI_CUU:
-                        emit moveCursorBy(-intargs.value(0, 1), 0);
-                        return ret;
-
-                    case ANSI_CUD:
-                        emit moveCursorBy(intargs.value(0, 1), 0);
-                        return ret;
-
-                    case ANSI_CUF:
-                        emit moveCursorBy(0, intargs.value(0, 1));
-                        return ret;
-
-                    case ANSI_CUB:
-                        emit moveCursorBy(0, -intargs.value(0, 1));
-                        return ret;
-
-                    case ANSI_CNL:
-                        emit moveCursorBy(intargs.value(0, 1), 0);
-                        emit moveCursorTo(-1, 0);
-                        return ret;
-
-                    case ANSI_CPL:
-                        emit moveCursorBy(-intargs.value(0, 1), 0);
-                        emit moveCursorTo(-1, 0);
-                        return ret;
-
-                    case ANSI_CHA:
-                        emit moveCursorTo(-1, intargs.value(0, 0));
-                        return ret;
-
-                    case ANSI_CUP:
-                    case ANSI_HVP:
-                        emit moveCursorTo(intargs.value(0, 1) - 1,
-                                          intargs.value(1, 1) - 1);
-                        return ret;
-
-                    case ANSI_ED:
-                        emit erase((EraseType)intargs.value(0, 0));
-                        return ret;
-
-                    case ANSI_EL:
-                        emit erase((EraseType)(intargs.value(0, 0) + 3));
-                        return ret;
-
-                    case ANSI_SU:
-                        emit scroll(-intargs.value(0, 1));
-                        return ret;
-
-                    case ANSI_SD:
-                        emit scroll(intargs.value(0, 1));
-                        return ret;
-
-                    case ANSI_SGR:
-                        handleSGR(intargs);
-                        return ret;
-
-                    case ANSI_DSR:
-                        emit reportCursorPosition();
-                        return ret;
-
-                    case ANSI_SCP:
-                        emit pushCursorPosition();
-                        return ret;
-
-                    case ANSI_RCP:
-                        emit popCursorPosition();
-                        return ret;
-
-                    case ANSI_INS:
-                        emit insert(intargs.value(0, 1));
-                        return ret;
-
-                    case ANSI_DEL:
-                        emit del(intargs.value(0, 1));
-                        return ret;
-
-                    case DECTCEM_HIC:
-                        emit setCursorVisible(false);
-                        return ret;
-
-                    case DECTCEM_SHC:
-                        emit setCursorVisible(true);
-                        return ret;
-
-                    default:
-                        unknownSequence(str, index, cmd, args);
-                        return ret;
-                }
+                __m128i lo = _mm256_castsi256_si128(v),
+                        hi = _mm256_extracti128_si256(v, 1);
+
+                _mm256_storeu_si256((__m256i *)out, _mm256_cvtepu8_epi16(lo));
+                _mm256_storeu_si256((__m256i *)(out + 16),
+                                    _mm256_cvtepu8_epi16(hi));
+
+                p += 32;
+                out += 32;
+                continue;
             }
-            else if (parseXterm(str, &cmd, &args, &ret))
+        }
+#endif
+
+#if defined(HAVE_SSE2)
+        if (end - p >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            __m128i special = _mm_or_si128(
+                        _mm_cmplt_epi8(v, _mm_set1_epi8(' ')),
+                        _mm_cmpeq_epi8(v, _mm_set1_epi8(ASCII_DEL)));
+
+            if (!_mm_movemask_epi8(special))
             {
-                switch (cmd)
-                {
-                    case XTERM_CNW:
-                    case XTERM_CIN:
-                    case XTERM_CWT:
-                        emit setWindowTitle(args);
-                        return ret;
-
-                    default:
-                        unknownSequence(str, index, cmd, args);
-                        return ret;
-                }
+                __m128i zero = _mm_setzero_si128();
+
+                _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(v, zero));
+                _mm_storeu_si128((__m128i *)(out + 8),
+                                 _mm_unpackhi_epi8(v, zero));
+
+                p += 16;
+                out += 16;
+                continue;
             }
-            else
+        }
+#endif
+
+        // Handle the rest one character at a time, until the next vector
+        uchar b = *p;
+
+        if (isPrintableAscii(b))
+        {
+            *out++ = QChar(b);
+            ++p;
+            continue;
+        }
+
+        if (b < 0x80)
+            break;
+
+        ++p;
+
+        uint c;
+        bool done = decode(b, &c);
+
+        while (!done && p < end && (*p & 0xc0) == 0x80)
+            done = decode(*p++, &c);
+
+        if (!done)
+        {
+            // The rest of the character is in the next read
+            if (p == end)
+                break;
+
+            // Cut short by a byte that can't continue it. Leave that byte for
+            // the next iteration
+            m_utf8Needed = 0;
+            c = QChar::ReplacementCharacter;
+        }
+
+        out = putChar(out, c);
+    }
+
+    if (out > m_text)
+        m_handler->print(m_text, out - m_text);
+
+    return p;
+}
+
+bool SpecialChars::decode(uchar b, uint *c)
+{
+    if (m_utf8Needed == 0)
+    {
+        if (b < 0x80)
+        {
+            *c = b;
+            return true;
+        }
+
+        // Lead bytes. 0xc0 and 0xc1 could only start overlong encodings, and
+        // anything past 0xf4 would encode a code point past U+10FFFF
+        if (b >= 0xc2 && b <= 0xdf)
+        {
+            m_utf8Char = b & 0x1f;
+            m_utf8Needed = 1;
+            m_utf8Min = 0x80;
+        }
+        else if (b >= 0xe0 && b <= 0xef)
+        {
+            m_utf8Char = b & 0x0f;
+            m_utf8Needed = 2;
+            m_utf8Min = 0x800;
+        }
+        else if (b >= 0xf0 && b <= 0xf4)
+        {
+            m_utf8Char = b & 0x07;
+            m_utf8Needed = 3;
+            m_utf8Min = 0x10000;
+        }
+        else
+        {
+            *c = QChar::ReplacementCharacter;
+            return true;
+        }
+
+        return false;
+    }
+
+    Q_ASSERT((b & 0xc0) == 0x80);
+
+    m_utf8Char = (m_utf8Char << 6) | (b & 0x3f);
+    if (--m_utf8Needed > 0)
+        return false;
+
+    *c = m_utf8Char;
+
+    if (*c < m_utf8Min || *c > 0x10ffff || QChar::isSurrogate(*c))
+        *c = QChar::ReplacementCharacter;
+
+    return true;
+}
+
+void SpecialChars::eat(uint c)
+{
+    int action, next;
+
+    if (c < 0x80)
+    {
+        uchar t = transitions[m_state][c];
+        action = t >> 4;
+        next = t & 0xf;
+    }
+    else
+    {
+        // Non-ASCII characters are text, unless they're part of a string
+        next = m_state;
+
+        if (m_state == STATE_GROUND)
+            action = ACTION_PRINT;
+        else if (m_state == STATE_OSC_STRING)
+            action = ACTION_OSC_PUT;
+        else
+            action = ACTION_IGNORE;
+    }
+
+    // Leaving the OSC string state (by BEL, ESC, CAN or SUB) ends the command
+    if (m_state == STATE_OSC_STRING && next != STATE_OSC_STRING)
+        dispatchOsc();
+
+    m_state = next;
+
+    switch (action)
+    {
+        case ACTION_PRINT:
+        {
+            QChar text[2];
+            m_handler->print(text, putChar(text, c) - text);
+            break;
+        }
+
+        case ACTION_EXECUTE:
+            execute(c);
+            break;
+
+        case ACTION_CLEAR:
+            m_numParams = 0;
+            m_private = 0;
+            m_numIntermediates = 0;
+            m_osc.clear();
+            break;
+
+        case ACTION_COLLECT:
+            if (m_numIntermediates < MAX_INTERMEDIATES)
+                m_intermediates[m_numIntermediates] = c;
+
+            ++m_numIntermediates;
+            break;
+
+        case ACTION_PARAM:
+            param(c);
+            break;
+
+        case ACTION_ESC_DISPATCH:
+            dispatchEsc(c);
+            break;
+
+        case ACTION_CSI_DISPATCH:
+            dispatchCsi(c);
+            break;
+
+        case ACTION_OSC_PUT:
+            if (m_osc.length() < MAX_OSC_LENGTH)
             {
-                unknownSequence(str, index, 0, QString());
+                QChar text[2];
+                m_osc.append(text, putChar(text, c) - text);
             }
+            break;
+    }
+}
 
-            return ret;
-        }
+void SpecialChars::execute(ushort c)
+{
+    switch (c)
+    {
+        case ASCII_BEL:
+            emit bell();
+            break;
+
+        case ASCII_BS:
+            m_handler->moveCursorBy(0, -1);
+            break;
+
+        case ASCII_CR:
+            m_handler->carriageReturn();
+            break;
+
+        case ASCII_DEL:
+            m_handler->del(1);
+            break;
+
+        case ASCII_FF:
+            m_handler->formFeed();
+            break;
+
+        case ASCII_HT:
+            m_handler->horizontalTab();
+            break;
+
+        case ASCII_VT:
+            m_handler->verticalTab();
+            break;
+
+        case ASCII_LF:
+            m_handler->lineFeed();
+            break;
 
         default:
-            return index;
+            // Other control characters are ignored
+            break;
     }
-
-    return index;
 }
 
-bool SpecialChars::parseAnsi(const QString &str, char *cmd, QString *args, int *index)
+void SpecialChars::param(ushort c)
 {
-    char next = str[*index + 1].toLatin1();
-    if (next == '[')
+    // The table only lets private markers through before the parameters
+    if (c >= 0x3c)
+    {
+        m_private = c;
+        return;
+    }
+
+    // Each separator starts a new parameter, and so does the first byte
+    bool separator = (c == ';' || c == ':');
+
+    if (separator || m_numParams == 0)
     {
-        // Multi-character sequence
-        int i = 2;
-        next = str[*index + i].toLatin1();
-        while (next < '@' || next > '~')
+        if (m_numParams == MAX_PARAMS)
         {
-            args->append(next);
-            ++i;
-            next = str[*index + i].toLatin1();
+            // Too many parameters to make sense of; drop the whole sequence
+            m_state = STATE_CSI_IGNORE;
+            return;
         }
 
-        *cmd = next;
-        *index += i + 1;
+        m_params[m_numParams] = -1;
+        m_paramSub[m_numParams] = (c == ':' && m_numParams > 0);
+        ++m_numParams;
 
-        return true;
+        // A sequence starting with a separator left out its first parameter
+        if (separator && m_numParams == 1)
+            param(c);
+
+        if (separator)
+            return;
     }
-    else if (next == ']')
+
+    int &value = m_params[m_numParams - 1];
+    value = qMin(qMax(value, 0) * 10 + (c - '0'), MAX_PARAM_VALUE);
+}
+
+int SpecialChars::param(int index, int def) const
+{
+    if (index >= m_numParams || m_params[index] < 0)
+        return def;
+
+    return m_params[index];
+}
+
+QString SpecialChars::paramString() const
+{
+    QString ret;
+
+    if (m_private != 0)
+        ret.append(QChar(m_private));
+
+    for (int i = 0; i < m_numParams; ++i)
     {
-        // xterm control sequence -- don't parse here
-        return false;
+        if (i > 0)
+            ret.append(m_paramSub[i] ? ':' : ';');
+
+        if (m_params[i] >= 0)
+            ret.append(QString::number(m_params[i]));
     }
-    else if (next >= '@' && next <= '_')
+
+    return ret;
+}
+
+void SpecialChars::dispatchEsc(ushort cmd)
+{
+    if (m_numIntermediates > 0)
     {
-        // Single-character sequence
-        *cmd = next;
-        *index += 2;
+        // Character set designations, which we don't support but which are
+        // common enough that they shouldn't be reported
+        ushort set = m_intermediates[0];
+        if (set != '(' && set != ')' && set != '*' && set != '+')
+            unknownSequence((char)cmd, QString(QChar(set)));
 
-        return true;
+        return;
     }
-    else
+
+    switch (cmd)
     {
-        // Don't know how to parse this
-        return false;
+        case DECSC:
+            m_handler->pushCursorPosition();
+            break;
+
+        case DECRC:
+            m_handler->popCursorPosition();
+            break;
+
+        case DECKPAM:
+        case DECKPNM:
+        case ESC_ST:
+            break;
+
+        default:
+            unknownSequence((char)cmd, QString());
+            break;
     }
 }
 
-bool SpecialChars::parseXterm(const QString &str, char *cmd, QString *args, int *index)
+void SpecialChars::dispatchCsi(ushort c)
 {
-    // Make sure this is an Operating System Control sequence
-    char next = str[*index + 1].toLatin1();
-    if (next != ']')
+    char cmd = (char)c;
+
+    // None of the sequences we support take intermediate bytes, and only mode
+    // changes take a private marker
+    if (m_numIntermediates > 0 ||
+        (m_private != 0 && cmd != ANSI_SM && cmd != ANSI_RM))
     {
-        return false;
+        unknownSequence(cmd, paramString());
+        return;
     }
 
-    // Parse the command ID
-    int i = 2;
-    QString cmdstr;
-    while ((next = str[*index + i].toLatin1()) != ';')
+    switch (cmd)
     {
-        cmdstr.append(next);
-        ++i;
+        case ANSI_CUU:
+            m_handler->moveCursorBy(-param(0, 1), 0);
+            break;
+
+        case ANSI_CUD:
+            m_handler->moveCursorBy(param(0, 1), 0);
+            break;
+
+        case ANSI_CUF:
+            m_handler->moveCursorBy(0, param(0, 1));
+            break;
+
+        case ANSI_CUB:
+            m_handler->moveCursorBy(0, -param(0, 1));
+            break;
+
+        case ANSI_CNL:
+            m_handler->moveCursorBy(param(0, 1), 0);
+            m_handler->moveCursorTo(-1, 0);
+            break;
+
+        case ANSI_CPL:
+            m_handler->moveCursorBy(-param(0, 1), 0);
+            m_handler->moveCursorTo(-1, 0);
+            break;
+
+        case ANSI_CHA:
+            m_handler->moveCursorTo(-1, param(0, 0));
+            break;
+
+        case ANSI_CUP:
+        case ANSI_HVP:
+            m_handler->moveCursorTo(param(0, 1) - 1,
+                                    param(1, 1) - 1);
+            break;
+
+        case ANSI_ED:
+            m_handler->erase((EraseType)param(0, 0));
+            break;
+
+        case ANSI_EL:
+            m_handler->erase((EraseType)(param(0, 0) + 3));
+            break;
+
+        case ANSI_SU:
+            m_handler->scroll(-param(0, 1));
+            break;
+
+        case ANSI_SD:
+            m_handler->scroll(param(0, 1));
+            break;
+
+        case ANSI_SGR:
+            handleSGR();
+            break;
+
+        case ANSI_DSR:
+            emit reportCursorPosition();
+            break;
+
+        case ANSI_SCP:
+            m_handler->pushCursorPosition();
+            break;
+
+        case ANSI_RCP:
+            m_handler->popCursorPosition();
+            break;
+
+        case DECSTBM:
+            m_handler->setScrollRegion(param(0, 1) - 1,
+                                       param(1, 0));
+            break;
+
+        case ANSI_INS:
+            m_handler->insert(param(0, 1));
+            break;
+
+        case ANSI_DEL:
+            m_handler->del(param(0, 1));
+            break;
+
+        case ANSI_SM:
+        case ANSI_RM:
+            if (!handleMode(cmd == ANSI_SM))
+                unknownSequence(cmd, paramString());
+            break;
+
+        default:
+            unknownSequence(cmd, paramString());
+            break;
+    }
+}
+
+void SpecialChars::dispatchOsc()
+{
+    // The command ID comes before the first semicolon
+    int sep = m_osc.indexOf(';');
+    if (sep < 0)
+    {
+        unknownSequence(']', m_osc);
+        return;
     }
 
     bool ok = false;
-    *cmd = cmdstr.toInt(&ok);
+    int cmd = m_osc.left(sep).toInt(&ok);
+    QString args = m_osc.mid(sep + 1);
+
     if (!ok)
     {
-        return false;
+        unknownSequence(']', m_osc);
+        return;
     }
 
-    // Parse the arguments
-    ++i; // Skip over the semicolon
-    while ((next = str[*index + i].toLatin1()) != ASCII_STX && next != ASCII_BEL)
+    switch (cmd)
     {
-        args->append(next);
-        ++i;
-    }
+        case XTERM_CNW:
+        case XTERM_CIN:
+        case XTERM_CWT:
+            emit setWindowTitle(args);
+            break;
 
-    *index += i + 1;
-    return true;
+        default:
+            unknownSequence(']', m_osc);
+            break;
+    }
 }
 
-void SpecialChars::handleSGR(QVector<int> args)
+bool SpecialChars::handleMode(bool set)
 {
-    // Check if colors need to be reset
-    foreach (int arg, args)
+    // Only DEC private modes are supported for now
+    if (m_private != '?')
+        return false;
+
+    bool handled = true;
+
+    for (int i = 0; i < m_numParams; ++i)
     {
-        if (arg == 0)
+        switch (m_params[i])
         {
-            emit resetColors();
-            break;
+            case DECTCEM:
+                emit setCursorVisible(set);
+                break;
+
+            case DEC_ALTBUF:
+            case DEC_ALTBUF_CLR:
+            case DEC_ALTBUF_CUR:
+                m_handler->setAlternateScreen(set);
+                break;
+
+            case DEC_SYNC:
+                m_handler->setSynchronizedOutput(set);
+                break;
+
+            default:
+                handled = false;
+                break;
         }
     }
 
-    // Check if the color needs to be bright
-    bool bright = false;
-    foreach (int arg, args)
+    return handled;
+}
+
+void SpecialChars::handleSGR()
+{
+    // A left out parameter means 0, so CSI m resets everything too
+    if (m_numParams == 0)
     {
-        if (arg == 1)
+        m_handler->resetStyle();
+        return;
+    }
+
+    for (int i = 0; i < m_numParams; ++i)
+    {
+        // Skip sub-parameters of codes that aren't handled below
+        if (m_paramSub[i])
+            continue;
+
+        int arg = param(i, 0);
+
+        // Sub-parameters only change the meaning of 4 (4:0 turns underline
+        // off) and the extended colors
+        bool hasSub = (i + 1 < m_numParams && m_paramSub[i + 1]);
+
+        switch (arg)
         {
-            bright = true;
-            break;
+            case SGR_RESET:
+                m_handler->resetStyle();
+                break;
+
+            case SGR_BOLD:
+                m_handler->setAttributes(Style::BOLD, true);
+                break;
+
+            case SGR_FAINT:
+                m_handler->setAttributes(Style::FAINT, true);
+                break;
+
+            case SGR_ITALIC:
+                m_handler->setAttributes(Style::ITALIC, true);
+                break;
+
+            case SGR_UNDERLINE:
+                m_handler->setAttributes(Style::UNDERLINE,
+                                         !hasSub || param(i + 1, 0) != 0);
+                break;
+
+            case SGR_DOUBLE_UNDER:
+                m_handler->setAttributes(Style::UNDERLINE, true);
+                break;
+
+            case SGR_BLINK:
+            case SGR_RAPID_BLINK:
+                m_handler->setAttributes(Style::BLINK, true);
+                break;
+
+            case SGR_INVERSE:
+                m_handler->setAttributes(Style::INVERSE, true);
+                break;
+
+            case SGR_HIDDEN:
+                m_handler->setAttributes(Style::HIDDEN, true);
+                break;
+
+            case SGR_STRIKEOUT:
+                m_handler->setAttributes(Style::STRIKEOUT, true);
+                break;
+
+            case SGR_NORMAL:
+                m_handler->setAttributes(Style::BOLD | Style::FAINT, false);
+                break;
+
+            case SGR_NO_ITALIC:
+                m_handler->setAttributes(Style::ITALIC, false);
+                break;
+
+            case SGR_NO_UNDERLINE:
+                m_handler->setAttributes(Style::UNDERLINE, false);
+                break;
+
+            case SGR_NO_BLINK:
+                m_handler->setAttributes(Style::BLINK, false);
+                break;
+
+            case SGR_NO_INVERSE:
+                m_handler->setAttributes(Style::INVERSE, false);
+                break;
+
+            case SGR_NO_HIDDEN:
+                m_handler->setAttributes(Style::HIDDEN, false);
+                break;
+
+            case SGR_NO_STRIKEOUT:
+                m_handler->setAttributes(Style::STRIKEOUT, false);
+                break;
+
+            case SGR_FG_EXT:
+            case SGR_BG_EXT:
+            {
+                int color = extendedColor(&i);
+                if (color >= 0)
+                    m_handler->setColor(color, arg == SGR_FG_EXT);
+                break;
+            }
+
+            case SGR_FG_DEFAULT:
+                m_handler->setColor(Style::DEFAULT_FOREGROUND, true);
+                break;
+
+            case SGR_BG_DEFAULT:
+                m_handler->setColor(Style::DEFAULT_BACKGROUND, false);
+                break;
+
+            default:
+                if (arg >= SGR_FG && arg < SGR_FG + 8)
+                    m_handler->setColor(arg - SGR_FG, true);
+                else if (arg >= SGR_BG && arg < SGR_BG + 8)
+                    m_handler->setColor(arg - SGR_BG, false);
+                else if (arg >= SGR_FG_BRIGHT && arg < SGR_FG_BRIGHT + 8)
+                    m_handler->setColor(arg - SGR_FG_BRIGHT + 8, true);
+                else if (arg >= SGR_BG_BRIGHT && arg < SGR_BG_BRIGHT + 8)
+                    m_handler->setColor(arg - SGR_BG_BRIGHT + 8, false);
+                break;
         }
     }
+}
 
-    // Check for a color to switch to
-    bool haveColor = false;
-    Color color = DEFAULT;
-    bool foreground = true;
+int SpecialChars::extendedColor(int *index) const
+{
+    int i = *index;
 
-    foreach (int arg, args)
+    // Gather the parameters describing the color. In the colon form these
+    // are all the sub-parameters; in the semicolon form, it depends on the
+    // color mode how many of the following parameters belong to the color
+    int values[6];
+    int n = 0;
+
+    if (i + 1 < m_numParams && m_paramSub[i + 1])
     {
-        if (arg >= 30 && arg <= 39 && arg != 38)
+        while (i + 1 < m_numParams && m_paramSub[i + 1])
         {
-            haveColor = true;
-            foreground = true;
-            color = (Color)(arg - 30);
-
-            break;
+            ++i;
+            if (n < 6)
+                values[n++] = m_params[i];
         }
 
-        if (arg >= 40 && arg <= 49 && arg != 48)
+        // 38:2:r:g:b may also be written with a color space id, which is
+        // ignored, as 38:2:id:r:g:b
+        if (n == 5 && values[0] == SGR_EXT_RGB)
         {
-            haveColor = true;
-            foreground = false;
-            color = (Color)(arg - 40);
-
-            break;
+            values[1] = values[2];
+            values[2] = values[3];
+            values[3] = values[4];
         }
     }
-
-    // If there's a color to switch to, switch
-    if (haveColor)
+    else
     {
-        emit setColor(color, bright, foreground);
+        int mode = param(i + 1, -1);
+        int count = (mode == SGR_EXT_RGB) ? 4 : 2;
+
+        while (n < count && i + 1 < m_numParams)
+            values[n++] = m_params[++i];
     }
 
-    // Otherwise check for any xterm-256 commands
-    else
-    {
-        for (int i = 0; i < args.size(); ++i)
-        {
-            int cmd = args[i];
+    *index = i;
 
-            if (cmd == 38 || cmd == 48)
-            {
-                bool foreground = (cmd == 38);
+    if (n >= 2 && values[0] == SGR_EXT_INDEX)
+    {
+        if (values[1] >= 0 && values[1] <= 255)
+            return values[1];
+    }
+    else if (n >= 4 && values[0] == SGR_EXT_RGB)
+    {
+        int r = qMax(values[1], 0),
+            g = qMax(values[2], 0),
+            b = qMax(values[3], 0);
 
-                if (i + 2 < args.size() && args[i + 1] == 5)
-                {
-                    emit setColor256(args[i + 2], foreground);
-                }
-            }
-        }
+        if (r <= 255 && g <= 255 && b <= 255)
+            return Style::rgb(r, g, b);
     }
+
+    return -1;
 }
 
 // http://unix.stackexchange.com/questions/16530/what-does-raw-unraw-keyboard-mode-mean
@@ -446,24 +1102,10 @@ QString SpecialChars::translate(QKeyEvent *ev)
     return ret;
 }
 
-void SpecialChars::unknownSequence(const QString &str, int index, 
-                                   char cmd, const QString &args)
+void SpecialChars::unknownSequence(char cmd, const QString &args)
 {
-    qDebug() << "Unknown control sequence starting at position"
-             << index;
-
-    // This is a separate call to qDebug() because (at least on my machine)
-    // the entire qDebug statement will no-op if the str has non-printable
-    // characters in it >.>
-    qDebug() << "in:\n"
-             << str;
-
-    if (cmd != 0)
-    {
-        qDebug() << "Parsed command: " << (int)cmd << " (" << cmd << ")\n"
-                 << "With args: " << args;
-    }
+    qDebug() << "Unknown control sequence:" << (int)cmd << "(" << cmd << ")"
+             << "with args" << args;
 
     qDebug() << "Output may be garbled\n";
 }
-
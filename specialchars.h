@@ -3,26 +3,30 @@
 
 #include <QKeyEvent>
 #include <QObject>
-#include <QVector>
+
+class EscapeHandler;
 
 /** Utility for recognizing and removing ASCII control codes and ANSI escape
  *  sequences from an input stream. This utility only recognizes special
  *  sequences; behavior for handling the sequences is defined elsewhere.
  *
- *  To use this object, TerminalWidget does the following:
+ *  Input is raw bytes from the shell, which are decoded from UTF-8 here as
+ *  they are parsed. Recognition is done by a state machine modeled on the
+ *  DEC VT500 parser (see http://vt100.net/emu/dec_ansi_parser). It consumes
+ *  one character at a time and keeps its state between calls, so a sequence
+ *  (or a multi-byte UTF-8 character) that is split across two reads from the
+ *  shell is handled the same as one that isn't.
  *
- *  - Instantiate a SpecialChars object
- *  - Hook up specific behaviors to signals of the SpecialChars object
- *  - When receiving input from the shell ...
+ *  Runs of plain text skip the state machine: they are decoded in bulk, with
+ *  a vectorized path for ASCII, and passed to the handler in a single
+ *  EscapeHandler::print() call.
  *
- *      while (inputStr.length() > 0)
- *      {
- *          if (!m_specialChars->eat(&inputStr))
- *          {
- *              writeCharacterToConsole(inputStr[0]);
- *              inputStr = inputStr.right(inputStr.length() - 1);
- *          }
- *      }
+ *  To use this object, TerminalWidget does the following:
+ *
+ *  - Instantiate a SpecialChars object, passing the EscapeHandler (the
+ *    History) that acts on the terminal's contents
+ *  - Hook up UI-level behaviors to signals of the SpecialChars object
+ *  - Pass everything received from the shell to parse()
  */
 class SpecialChars : public QObject
 {
@@ -59,153 +63,147 @@ public:
         ERASE_LINE          = 5,
     };
 
-    enum Color
-    {
-        BLACK   = 0,
-        RED     = 1,
-        GREEN   = 2,
-        YELLOW  = 3,
-        BLUE    = 4,
-        MAGENTA = 5,
-        CYAN    = 6,
-        WHITE   = 7,
-
-        DEFAULT = 9,
-    };
-
-    SpecialChars();
+    /** Creates a parser that passes the sequences it recognizes to the given
+     *  handler. The handler must outlive this object.
+     */
+    explicit SpecialChars(EscapeHandler *handler);
     ~SpecialChars();
 
-    /** Tries to eat a special character sequence from the beginning of the
-     *  given string.
-     *
-     *  If the string starts with a control sequence, this method triggers the
-     *  relevant signal, modifies the given string by removing the first
-     *  character, and returns true.
-     *
-     *  Otherwise, the method returns false and does not modify the string.
-     *
-     *  @param str  A pointer to the input string to eat characters from. If an
-     *              escape sequence is removed from the start of the string,
-     *              this pointers receives the new string.
-     *
-     *  @return     A boolean indicating whether a sequence was removed.
-     */
-    //bool eat(QString *str);
-    int eat(const QString &str, int index);
+    /** Parses the given bytes of shell output, calling the handler (or
+     *  raising signals) for every piece of text and every control sequence
+     *  it contains. Anything left incomplete at the end of the data is
+     *  remembered and finished by the next call.
+     */
+    void parse(const char *data, int length);
 
     /** Returns a string containing scancodes for any special keys containing
-     *  in the given key event
+     *  in the given key event. This doesn't depend on the parser's state, so
+     *  it is safe to call from any thread
      */
-    QString translate(QKeyEvent *ev);
+    static QString translate(QKeyEvent *ev);
 
 signals:
 
     /** Play the system bell sound */
     void bell();
 
-    /** Move the cursor to the beginning of its line */
-    void carriageReturn();
-
-    /** Delete n characters on this line, starting at the cursor */
-    void del(int n);
-
-    /** Clear some part of the screen. See EraseType for specific behaviors */
-    void erase(SpecialChars::EraseType type);
+    /** Invoke Shell::reportCursorPosition() 
+     *  TODO implement Shell::reportCursorPosition()
+     */
+    void reportCursorPosition();
 
-    /** Clear the screen */
-    void formFeed();
+    /** Show or hide the cursor */
+    void setCursorVisible(bool visible);
 
-    /** Indent the cursor */
-    void horizontalTab();
+    /** Set the title of the terminal's window or tab */
+    void setWindowTitle(const QString &title);
+    
+private:
+    /** Receives everything but the UI-level events raised as signals */
+    EscapeHandler *m_handler;
 
-    /** Insert n blank characters, starting at the cursor.
-     *  Do not move the cursor.
+    /** The current parser state (one of the STATE_* values in
+     *  specialchars.cpp)
      */
-    void insert(int n);
+    int m_state;
 
-    /** Move the cursor relative to its current position */
-    void moveCursorBy(int rowDelta, int colDelta);
+    /** The parameters of the control sequence being parsed, converted to
+     *  integers as they are read. A parameter that was left out is -1.
+     *  m_paramSub[i] is true if parameter i is a sub-parameter of the one
+     *  before it (separated by a colon, as in 38:2:r:g:b) rather than a
+     *  parameter of its own.
+     */
+    static const int MAX_PARAMS = 32;
+    int m_params[MAX_PARAMS];
+    bool m_paramSub[MAX_PARAMS];
+    int m_numParams;
 
-    /** Move the cursor to the given position.
-     *  If either row or col is negative, don't change the corresponding
-     *  property of the cursor
+    /** The private marker (one of < = > ?) that started the parameters of
+     *  the control sequence being parsed, or 0 if there wasn't one
      */
-    void moveCursorTo(int row, int col);
+    ushort m_private;
 
-    /** Invoke Shell::reportCursorPosition() 
-     *  TODO implement Shell::reportCursorPosition()
+    /** The intermediate bytes of the sequence being parsed. Only the first
+     *  MAX_INTERMEDIATES are kept, but all of them are counted
      */
-    void reportCursorPosition();
+    static const int MAX_INTERMEDIATES = 2;
+    ushort m_intermediates[MAX_INTERMEDIATES];
+    int m_numIntermediates;
 
-    /** Set the cursor position to the position stored during the
-     *  corresponding pushCursorPosition() operation. If there is no matching
-     *  operation, do nothing.
+    /** The contents of the OS command being parsed */
+    QString m_osc;
+
+    /** The UTF-8 character being decoded: the bits seen so far, how many
+     *  continuation bytes are still needed, and the smallest code point that
+     *  may be encoded with this many bytes (anything below is overlong)
      */
-    void popCursorPosition();
+    uint m_utf8Char;
+    int m_utf8Needed;
+    uint m_utf8Min;
 
-    /** Store the cursor's current position on a stack */
-    void pushCursorPosition();
+    /** Scratch space for decoding runs of text, so that doesn't allocate */
+    static const int TEXT_CHUNK = 4096;
+    QChar m_text[TEXT_CHUNK];
 
-    /** Sets the terminal colors back to the default */
-    void resetColors();
+    /** Feeds one decoded character to the state machine */
+    void eat(uint c);
 
-    /** Scroll down by the given number of pages.
-     *  If npages is negative, scroll up by that many pages
+    /** Decodes and prints a run of text starting at p, and returns a pointer
+     *  to the first byte after it. The run ends at the first C0 control
+     *  character or DEL, or at a multi-byte character cut off by the end of
+     *  the data (which is left in m_utf8Char).
      */
-    void scroll(int npages);
+    const uchar *printText(const uchar *p, const uchar *end);
 
-    /** Set either the foreground or the background color
-      * @param c indicates which color from the theme palette to use
-      * @param bright indicates whether the bright or normal color is desired
-      * @param foreground indicates whether to set the foreground or background
-      *                   color
-      */
-    void setColor(SpecialChars::Color c, bool bright, bool foreground);
+    /** Feeds a byte to the UTF-8 decoder. Returns true and sets *c once a
+     *  character is complete. Invalid bytes and sequences decode to U+FFFD.
+     *  If a character is in progress, b must be a continuation byte.
+     */
+    bool decode(uchar b, uint *c);
 
-    /** Set either the foreground or the background color from a 256-color
-      * scheme.
-      * @param index is the color to use. 0 <= index <= 255
-      * @param foreground indicates whether to set the foreground or background
-      *                   color
-      */
-    void setColor256(int index, bool foreground);
+    /** Handles a C0 control character */
+    void execute(ushort c);
 
-    /** Show or hide the cursor */
-    void setCursorVisible(bool visible);
+    /** Adds a parameter byte (a digit, a separator or a private marker) of a
+     *  control sequence to m_params
+     */
+    void param(ushort c);
 
-    /** Set the title of the terminal's window or tab */
-    void setWindowTitle(const QString &title);
+    /** Returns the value of the given parameter of the control sequence, or
+     *  def if it was left out
+     */
+    int param(int index, int def) const;
 
-    /** Add several newlines */
-    void verticalTab();
-    
-private:
-    /** Attempts to parse an ANSI control sequence.
-     *  Removes the sequence from the input string if successful.
-     *
-     *  @param str      The input string
-     *  @param cmd      Receives the command code
-     *  @param args     Receives the command arguments
-     *  @param index    The index of the next char after the sequence
+    /** Returns the parameters of the control sequence in their original
+     *  text form, for debug output
      */
-    bool parseAnsi(const QString &str, char *cmd, QString *args, int *index);
+    QString paramString() const;
 
-    /** Attempts to parse an xterm OS control sequence.
-     *  Removes the sequence from the input string if successful.
-     *
-     *  @param str      The input string
-     *  @param cmd      Receives the command code
-     *  @param args     Receives the command arguments
-     *  @param index    The index of the next char after the sequence
+    /** Handle a completed escape sequence, control sequence or OS command */
+    void dispatchEsc(ushort cmd);
+    void dispatchCsi(ushort cmd);
+    void dispatchOsc();
+
+    /** Triggers events for the DEC private modes set (or reset, if set is
+     *  false) by a CSI ... h (or l) sequence. Returns false if any mode in the
+     *  sequence was not recognized.
+     */
+    bool handleMode(bool set);
+
+    /** Passes the attributes and colors set by an SGR sequence on to the
+     *  handler
      */
-    bool parseXterm(const QString &str, char *cmd, QString *args, int *index);
+    void handleSGR();
 
-    /** Triggers setColor and setColor256 events for ASCII SGR codes */
-    void handleSGR(QVector<int> args);
+    /** Parses the color of an extended color parameter (38 or 48) at the
+     *  given index, in either the 38;5;n / 38;2;r;g;b form or the 38:5:n /
+     *  38:2::r:g:b form. Returns the color as a Style color value, or -1 if
+     *  it is malformed, and moves index to the last parameter used.
+     */
+    int extendedColor(int *index) const;
 
     /** On a debug build, prints a warning about an unknown control sequence */
-    void unknownSequence(const QString &str, int index, char cmd, const QString &args);
+    void unknownSequence(char cmd, const QString &args);
 };
 
 #endif // SPECIALCHARS_H
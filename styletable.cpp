@@ -0,0 +1,78 @@
+#include "styletable.h"
+
+StyleTable::StyleTable()
+{
+    intern(Style());
+}
+
+StyleTable::~StyleTable() { }
+
+ushort StyleTable::intern(const Style &style)
+{
+    QHash<Style, ushort>::const_iterator it = m_ids.constFind(style);
+    if (it != m_ids.constEnd())
+        return it.value();
+
+    ushort id;
+
+    if (!m_free.isEmpty())
+    {
+        id = m_free.last();
+        m_free.removeLast();
+        m_styles[id] = style;
+    }
+    else if (m_styles.size() < MAX_STYLES)
+    {
+        id = (ushort)m_styles.size();
+        m_styles.append(style);
+    }
+    else
+    {
+        return 0;
+    }
+
+    m_ids.insert(style, id);
+    return id;
+}
+
+const Style &StyleTable::style(ushort id) const
+{
+    Q_ASSERT(id < m_styles.size());
+
+    return m_styles[id];
+}
+
+int StyleTable::size() const
+{
+    return m_ids.size();
+}
+
+bool StyleTable::isFull() const
+{
+    return m_free.isEmpty() && m_styles.size() == MAX_STYLES;
+}
+
+int StyleTable::sweep(const QBitArray &live)
+{
+    Q_ASSERT(live.size() == MAX_STYLES);
+
+    int freed = 0;
+
+    for (int id = 1; id < m_styles.size(); ++id)
+    {
+        if (live.testBit(id))
+            continue;
+
+        // Slots that are already free hold a style that's since been
+        // interned under another id, or not at all
+        QHash<Style, ushort>::iterator it = m_ids.find(m_styles[id]);
+        if (it == m_ids.end() || it.value() != id)
+            continue;
+
+        m_ids.erase(it);
+        m_free.append(id);
+        ++freed;
+    }
+
+    return freed;
+}
@@ -0,0 +1,124 @@
+#ifndef STYLETABLE_H
+#define STYLETABLE_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QVector>
+
+/** The graphics state a cell is rendered with, as set by SGR sequences */
+struct Style
+{
+    /** Flags for the attributes field */
+    enum Attribute
+    {
+        BOLD        = 0x01,
+        FAINT       = 0x02,
+        ITALIC      = 0x04,
+        UNDERLINE   = 0x08,
+        BLINK       = 0x10,
+        INVERSE     = 0x20,
+        HIDDEN      = 0x40,
+        STRIKEOUT   = 0x80,
+    };
+
+    /** The colors of cells no SGR sequence has touched */
+    static const int DEFAULT_FOREGROUND = 7;
+    static const int DEFAULT_BACKGROUND = 0;
+
+    /** Colors with this bit set are 24-bit colors in the low bits (see
+     *  rgb()). Other colors are color palette indices
+     */
+    static const int RGB = 0x1000000;
+
+    Style()
+        : foreground(DEFAULT_FOREGROUND),
+          background(DEFAULT_BACKGROUND),
+          attributes(0)
+    { }
+
+    Style(int fg, int bg, int attributes = 0)
+        : foreground(fg), background(bg), attributes(attributes)
+    { }
+
+    /** Returns the color value for the given 24-bit color */
+    static int rgb(int r, int g, int b)
+    {
+        return RGB | (r << 16) | (g << 8) | b;
+    }
+
+    /** Returns true if the given color value was made by rgb() */
+    static bool isRgb(int color)
+    {
+        return (color & RGB) != 0;
+    }
+
+    /** The foreground and background colors. See RGB */
+    int foreground;
+    int background;
+
+    /** A combination of Attribute flags */
+    int attributes;
+};
+
+inline bool operator==(const Style &a, const Style &b)
+{
+    return a.foreground == b.foreground &&
+           a.background == b.background &&
+           a.attributes == b.attributes;
+}
+
+inline uint qHash(const Style &s)
+{
+    return ((uint)s.foreground * 31 + (uint)s.background) * 31 +
+           (uint)s.attributes;
+}
+
+/** Interns Style values so cells can refer to them by a small integer id.
+ *
+ *  Each distinct style is stored once. Id 0 is always the default style.
+ *  However many attributes and 24-bit colors a style has, a cell only ever
+ *  pays for its two-byte id.
+ *
+ *  The table doesn't know which ids are still in use. Once it fills up, the
+ *  owner should mark the ids its cells refer to and sweep() the rest, whose
+ *  ids are then handed out again.
+ */
+class StyleTable
+{
+public:
+    StyleTable();
+    ~StyleTable();
+
+    /** Returns the id of the given style, adding it to the table if this is
+     *  the first time it has been seen. If the table is full, returns the id
+     *  of the default style.
+     */
+    ushort intern(const Style &style);
+
+    /** Returns the style with the given id */
+    const Style &style(ushort id) const;
+
+    /** Returns the number of distinct styles in the table */
+    int size() const;
+
+    /** Returns true if intern() can't add any more styles */
+    bool isFull() const;
+
+    /** Frees every id that isn't set in live, which must have MAX_STYLES
+     *  bits. The default style is never freed. Returns the number of ids
+     *  freed
+     */
+    int sweep(const QBitArray &live);
+
+    /** The largest number of styles that fit in a cell's style id */
+    static const int MAX_STYLES = 0x10000;
+
+private:
+    QVector<Style>          m_styles;
+    QHash<Style, ushort>    m_ids;
+
+    /** Ids freed by sweep(), to be reused before the table grows */
+    QVector<ushort>         m_free;
+};
+
+#endif // STYLETABLE_H
@@ -1,7 +1,10 @@
 #include "terminalwidget.h"
 
+#include "latencytrace.h"
+
 #include <QApplication>
 #include <QBrush>
+#include <QClipboard>
 #include <QColor>
 #include <QFont>
 #include <QFontMetrics>
@@ -12,10 +15,12 @@
 
 TerminalWidget::TerminalWidget(QWidget *parent) 
     : QWidget(parent),
-      m_shell(Shell::create()),
+      m_session(new Session),
       m_cursor(this),
+      m_frame(new Frame),
       m_layout(new QHBoxLayout),
-      m_scrollBar(new QScrollBar)
+      m_scrollBar(new QScrollBar),
+      m_savedScrollAmount(0)
 {
     // Set up the scroll bar
     ((QHBoxLayout*)m_layout)->addWidget(m_scrollBar, 0, Qt::AlignRight);
@@ -25,39 +30,31 @@ TerminalWidget::TerminalWidget(QWidget *parent)
     m_scrollBar->setTracking(true);
     connect(m_scrollBar, SIGNAL(sliderMoved(int)), this, SLOT(onScroll(int)));
 
-    // Set up handlers for escape sequences received from the shell
-    connect(&m_chars, SIGNAL(bell()), SLOT(doBell()));
-    connect(&m_chars, SIGNAL(setCursorVisible(bool)),
-                      SLOT(doSetCursorVisible(bool)));
-    connect(&m_chars, SIGNAL(setWindowTitle(const QString&)), 
-                      SLOT(doSetWindowTitle(const QString&)));
-
-    // Set up handlers for history events
-    connect(&m_history, SIGNAL(cursorMoved(int, int)),
-            &m_cursor,  SLOT(moveTo(int, int)));
-    connect(&m_history, SIGNAL(updated()),
-                        SLOT(update()));
-    connect(&m_history, SIGNAL(scrollToBottom()),
-                        SLOT(onHistoryScrollToBottom()));
-
-    m_history.connectTo(&m_chars);
-
-    // Set up handlers for shell events
-    connect(m_shell, SIGNAL(read(QString)), SLOT(onShellRead(QString)));
-    connect(m_shell, SIGNAL(closed()), SLOT(onShellExited()));
-    m_shell->open();
+    // Set up handlers for UI-level escape sequences received from the shell.
+    // Everything else is handled on the session's thread
+    connect(m_session, SIGNAL(bell()), SLOT(doBell()));
+    connect(m_session, SIGNAL(setCursorVisible(bool)),
+                       SLOT(doSetCursorVisible(bool)));
+    connect(m_session, SIGNAL(setWindowTitle(const QString&)), 
+                       SLOT(doSetWindowTitle(const QString&)));
+
+    // Set up handlers for session events
+    connect(m_session, SIGNAL(frameReady()), SLOT(onFrameReady()));
+    connect(m_session, SIGNAL(closed()), SLOT(onShellExited()));
+    m_session->start();
 }
 
 TerminalWidget::~TerminalWidget() 
 { 
-    delete m_shell;
+    delete m_session;
+    delete m_frame;
     delete m_scrollBar;
     delete m_layout;
 }
 
-const History& TerminalWidget::history() const
+const Frame &TerminalWidget::frame() const
 {
-    return m_history;
+    return *m_frame;
 }
 
 int TerminalWidget::scrollAmount()
@@ -70,43 +67,113 @@ void TerminalWidget::setScrollAmount(int val)
     m_scrollBar->setValue(val);
 }
 
-QColor TerminalWidget::foregroundColorAt(int row, int col) const
+const Theme &TerminalWidget::theme() const
 {
-    return m_theme.color(m_history.foregroundColorAt(row, col));
+    return m_theme;
 }
 
-QColor TerminalWidget::backgroundColorAt(int row, int col) const
+void TerminalWidget::onFrameReady()
 {
-    return m_theme.color(m_history.backgroundColorAt(row, col));
-}
+    Frame *frame = m_session->takeFrame();
+    if (!frame)
+        return;
 
-void TerminalWidget::onShellRead(const QString &input)
-{
-    m_history.beginWrite();
+    Frame *prev = m_frame;
+    m_frame = frame;
 
-    int i = 0;
-    while (i < input.length())
+    QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
+    QFontMetrics fm(font);
+
+    // Row numbers refer to a different buffer after switching screens. Save
+    // the scroll position when entering the alternate screen, and restore it
+    // when leaving
+    if (frame->alternate != prev->alternate)
     {
-        int next = m_chars.eat(input, i);
-        if (next == i)
-        {
-            m_history.write(input[i++]);
-        }
+        if (frame->alternate)
+            m_savedScrollAmount = scrollAmount();
+
+        calcScrollbarSize();
+
+        if (frame->alternate)
+            setScrollAmount(0);
         else
-        {
-            i = next;
-        }
+            setScrollAmount(m_savedScrollAmount);
+    }
+
+    if (frame->formFeeds != prev->formFeeds)
+    {
+        calcScrollbarSize();
+        m_scrollBar->setValue(m_scrollBar->maximum());
     }
 
-    m_history.endWrite();
+    // Keep the same text in view when rows are dropped from the top. Read
+    // the old value before resizing the scroll bar, since shrinking its
+    // range clamps the value.
+    if (frame->evicted != prev->evicted)
+    {
+        int rows = frame->evicted - prev->evicted,
+            value = qMax(0, scrollAmount() - rows * fm.lineSpacing());
+
+        calcScrollbarSize();
+        setScrollAmount(value);
+    }
 
     calcScrollbarSize();
-    scrollToEnd();
+
+    if (frame->writes != prev->writes)
+        scrollToEnd();
+
+    // Damage is relative to the previous frame, so it's only usable if we
+    // didn't skip any
+    if (frame->serial == prev->serial + 1 && !frame->damage.all)
+        repaintDamage(*frame);
+    else
+        update();
+
+    if (frame->cursorRow != m_cursor.row() || frame->cursorCol != m_cursor.col())
+        m_cursor.moveTo(frame->cursorRow, frame->cursorCol);
+
+    delete prev;
+
+    requestRows();
 }
 
 void TerminalWidget::keyPressEvent(QKeyEvent *ev)
 {
-    m_shell->write(m_chars.translate(ev));
+    // Ctrl+Shift+V and Shift+Insert paste from the clipboard
+    Qt::KeyboardModifiers mods = ev->modifiers();
+
+    bool paste = (ev->key() == Qt::Key_V
+                  && mods == (Qt::ControlModifier | Qt::ShiftModifier))
+              || (ev->key() == Qt::Key_Insert && mods == Qt::ShiftModifier);
+
+    if (paste)
+    {
+        if (!m_session->paste(QApplication::clipboard()->text()))
+        {
+            qWarning("Paste refused: too much input is already waiting");
+            QApplication::beep();
+        }
+
+        return;
+    }
+
+    // Ctrl+Shift+F12 writes out the latency histograms, when tracing
+    if (ev->key() == Qt::Key_F12
+        && mods == (Qt::ControlModifier | Qt::ShiftModifier)
+        && LatencyTrace::enabled())
+    {
+        LatencyTrace::dump();
+        return;
+    }
+
+    LatencyTrace::mark(LatencyTrace::KeyPressed);
+
+    if (!m_session->write(SpecialChars::translate(ev)))
+    {
+        qWarning("Key dropped: the shell isn't reading its input");
+        QApplication::beep();
+    }
 }
 
 void TerminalWidget::paintEvent(QPaintEvent *)
@@ -125,13 +192,10 @@ void TerminalWidget::paintEvent(QPaintEvent *)
     QBrush bg(m_theme.color(0));
     p.fillRect(0, 0, width(), height(), bg);
 
-    // Draw text
+    // Draw text. The frame may hold a few rows outside the view; those are
+    // clipped
     QFontMetrics fm(font);
-    RenderData rd = m_history.renderData(m_scrollBar->value(),
-                                         m_scrollBar->value() + height(),
-                                         fm.lineSpacing());
-
-    int y = fm.lineSpacing() - (m_scrollBar->value() % fm.lineSpacing());
+    RenderData rd = m_frame->renderData;
     rd.begin();
 
     while (rd.nextLine())
@@ -141,26 +205,38 @@ void TerminalWidget::paintEvent(QPaintEvent *)
 
         while (rd.next(&section))
         {
-            if (section.background != 0)
+            const Style &style = section.style;
+            int y = (section.line + 1) * fm.lineSpacing() - scrollAmount();
+
+            if (style.background != Style::DEFAULT_BACKGROUND ||
+                (style.attributes & Style::INVERSE))
             {
                 p.fillRect(x, y,
                            section.data.size() * fm.averageCharWidth(),
                            fm.lineSpacing(),
-                           QBrush(m_theme.color(section.background)));
+                           QBrush(m_theme.background(style)));
             }
 
-            p.setPen(m_theme.color(section.foreground));
+            // Blinking text is drawn steadily
+            QFont styled(font);
+            styled.setBold((style.attributes & Style::BOLD) != 0);
+            styled.setItalic((style.attributes & Style::ITALIC) != 0);
+            styled.setUnderline((style.attributes & Style::UNDERLINE) != 0);
+            styled.setStrikeOut((style.attributes & Style::STRIKEOUT) != 0);
+
+            p.setFont(styled);
+            p.setPen(m_theme.foreground(style));
             p.drawText(x, y, section.data);
             x += fm.averageCharWidth() * section.data.size();
         }
-
-        y += fm.lineSpacing();
     }
 
     rd.end();
 
     // Draw the cursor, if applicable
     m_cursor.render(p);
+
+    LatencyTrace::mark(LatencyTrace::Painted, m_frame->writes);
 }
 
 void TerminalWidget::resizeEvent(QResizeEvent *)
@@ -173,9 +249,10 @@ void TerminalWidget::resizeEvent(QResizeEvent *)
         numRows = h / fm.lineSpacing(),
         numCols = w / fm.averageCharWidth();
 
-    m_history.onViewportResized(numRows, numCols);
+    m_session->resize(numRows, numCols);
 
     calcScrollbarSize();
+    requestRows();
     update();
 }
 
@@ -192,6 +269,7 @@ void TerminalWidget::wheelEvent(QWheelEvent *we)
 
     setScrollAmount(scrollAmount() - delta);
     calcScrollbarSize();
+    requestRows();
     update();
 }
 
@@ -203,21 +281,16 @@ void TerminalWidget::onShellExited()
 void TerminalWidget::onScroll(int)
 {
     calcScrollbarSize();
+    requestRows();
     update();
 }
 
-void TerminalWidget::onHistoryScrollToBottom()
-{
-    calcScrollbarSize();
-    m_scrollBar->setValue(m_scrollBar->maximum());
-}
-
 void TerminalWidget::calcScrollbarSize()
 {
     QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
     QFontMetrics fm(font);
 
-    int nLines = m_history.numLines();
+    int nLines = m_frame->numLines;
     int contentHeight = nLines * fm.lineSpacing();
 
     m_scrollBar->setMinimum(0);
@@ -233,7 +306,7 @@ void TerminalWidget::scrollToEnd()
     QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
     QFontMetrics fm(font);
 
-    int nLines = m_history.numLines();
+    int nLines = m_frame->numLines;
     int contentHeight = nLines * fm.lineSpacing();
 
     int minValue = contentHeight - height() + fm.lineSpacing();
@@ -241,6 +314,41 @@ void TerminalWidget::scrollToEnd()
         setScrollAmount(minValue);
 }
 
+void TerminalWidget::requestRows()
+{
+    QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
+    QFontMetrics fm(font);
+
+    int numLines = m_frame->numLines,
+        first = qMin(scrollAmount() / fm.lineSpacing(), qMax(numLines - 1, 0)),
+        last = qMin((scrollAmount() + height()) / fm.lineSpacing() + 1,
+                    numLines);
+
+    if (first < m_frame->firstRow || last > m_frame->lastRow)
+        m_session->scrollTo(first);
+}
+
+void TerminalWidget::repaintDamage(const Frame &frame)
+{
+    const Screen::Damage &d = frame.damage;
+
+    if (d.scrolled != 0)
+    {
+        QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
+        QFontMetrics fm(font);
+
+        // Shift what's already on screen instead of redrawing it. The cursor
+        // was drawn into those pixels too, so repaint wherever it ended up.
+        scroll(0, -d.scrolled * fm.lineSpacing(),
+               rowsRect(d.scrollTop, d.scrollBottom - 1));
+        update(rowsRect(m_cursor.row() - d.scrolled,
+                        m_cursor.row() - d.scrolled));
+    }
+
+    if (d.lastRow >= d.firstRow)
+        update(rowsRect(d.firstRow, d.lastRow));
+}
+
 void TerminalWidget::doBell() 
 { 
     QApplication::beep();
@@ -263,3 +371,17 @@ void TerminalWidget::doSetWindowTitle(const QString &title)
 {
     ((QWidget*)parent()->parent())->setWindowTitle(title);
 }
+
+QRect TerminalWidget::rowsRect(int first, int last) const
+{
+    QFont font(TERMINAL_FONT_FAMILY, TERMINAL_FONT_HEIGHT);
+    QFontMetrics fm(font);
+
+    // Text is drawn on a baseline one line below the top of its row, and
+    // descenders hang below that
+    int h = fm.lineSpacing(),
+        w = width() - (m_scrollBar->isVisible() ? m_scrollBar->width() : 0),
+        y = first * h - m_scrollBar->value() + fm.descent();
+
+    return QRect(0, y, w, (last - first + 1) * h);
+}
@@ -2,9 +2,8 @@
 #define TERMINALWIDGET_H
 
 #include "cursor.h"
-#include "history.h"
-#include "shell.h"
-#include "specialchars.h"
+#include "frame.h"
+#include "session.h"
 #include "theme.h"
 
 #include <QLayout>
@@ -17,6 +16,9 @@
 
 /** Fills the primary terminal window, rendering terminal output
   * text and accepting user input
+  *
+  * The shell and the model of its output live on the Session's thread. This
+  * widget only ever paints the latest Frame the session published.
   */
 class TerminalWidget : public QWidget
 {
@@ -26,18 +28,15 @@ public:
     explicit TerminalWidget(QWidget *parent = 0);
     ~TerminalWidget();
 
-    /** Gets the object that tracks the input history */
-    const History &history() const;
+    /** Gets the snapshot of the terminal that is currently on screen */
+    const Frame &frame() const;
 
     /** Gets or sets the amount the view has been scrolled, in pixels */
     int scrollAmount();
     void setScrollAmount(int);
 
-    /** Gets the foreground or background color of the cell at the given row
-     *  and column (in cursor coordinates)
-     */
-    QColor foregroundColorAt(int row, int col) const;
-    QColor backgroundColorAt(int row, int col) const;
+    /** Gets the color theme used to render the terminal */
+    const Theme &theme() const;
 
 protected:
     void keyPressEvent(QKeyEvent *);
@@ -46,28 +45,46 @@ protected:
     void wheelEvent(QWheelEvent *);
 
 private slots:
-    void onShellRead(const QString &data);
+    void onFrameReady();
     void onShellExited();
 
     void onScroll(int);
-    void onHistoryScrollToBottom();
 
     void doBell();
     void doSetCursorVisible(bool visible);
     void doSetWindowTitle(const QString &title);
 
 private:
-    History m_history;
-    Shell *m_shell;
+    Session *m_session;
     Cursor m_cursor;
-    SpecialChars m_chars;
     Theme m_theme;
 
+    /** The frame being displayed. Never null */
+    Frame *m_frame;
+
     QLayout *m_layout;
     QScrollBar *m_scrollBar;
 
+    /** The scroll position of the scrollback, saved while the alternate
+     *  screen is active
+     */
+    int m_savedScrollAmount;
+
     void calcScrollbarSize();
     void scrollToEnd();
+
+    /** Asks the session for the rows in view, if the current frame doesn't
+     *  have all of them
+     */
+    void requestRows();
+
+    /** Shifts and repaints the parts of the screen described by the damage
+     *  in the given frame
+     */
+    void repaintDamage(const Frame &frame);
+
+    /** Returns the area of the widget covered by the rows [first, last] */
+    QRect rowsRect(int first, int last) const;
 };
 
 #endif // TERMINALWIDGET_H
@@ -13,6 +13,41 @@ QColor Theme::color(int index) const
     return m_palette.value(index, QColor(255, 0, 255));
 }
 
+QColor Theme::styleColor(int color) const
+{
+    if (Style::isRgb(color))
+        return QColor((color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff);
+
+    return this->color(color);
+}
+
+QColor Theme::foreground(const Style &style) const
+{
+    int fg = style.foreground;
+    if ((style.attributes & Style::BOLD) && !Style::isRgb(fg) && fg < 8)
+        fg += 8;
+
+    if (style.attributes & Style::INVERSE)
+        fg = style.background;
+
+    QColor ret = styleColor(fg);
+
+    if (style.attributes & Style::HIDDEN)
+        ret = background(style);
+    else if (style.attributes & Style::FAINT)
+        ret.setAlpha(128);
+
+    return ret;
+}
+
+QColor Theme::background(const Style &style) const
+{
+    if (style.attributes & Style::INVERSE)
+        return styleColor(style.foreground);
+
+    return styleColor(style.background);
+}
+
 void Theme::setColor(int index, const QColor &c)
 {
     if (index >= 0 && index <= 255)
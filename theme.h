@@ -1,6 +1,8 @@
 #ifndef THEME_H
 #define THEME_H
 
+#include "styletable.h"
+
 #include <QColor>
 #include <QVector>
 
@@ -15,6 +17,19 @@ public:
     QColor color(int index) const;
     void setColor(int index, const QColor &c);
 
+    /** Returns the color for a Style color value, which is either a palette
+     *  index or a 24-bit color
+     */
+    QColor styleColor(int color) const;
+
+    /** Returns the colors text in the given style is drawn with, taking the
+     *  inverse, hidden and faint attributes into account. Like most
+     *  terminals, bold text in one of the first 8 palette colors is drawn in
+     *  the bright version of that color.
+     */
+    QColor foreground(const Style &style) const;
+    QColor background(const Style &style) const;
+
     // TODO other things like theme names and file paths
     //      will be added when we support theme options
 